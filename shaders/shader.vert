@@ -47,9 +47,37 @@ layout (location = 4) in vec4 vJoint;
 layout (location = 5) in vec4 vWeight;
 layout (location = 6) in vec4 vTangent;
 
+//* COMPACT_HR_PARTICLES is defined when the vertex shader is compiled for HRParticleFormat::eCompact
+#ifdef COMPACT_HR_PARTICLES
+struct HRParticle{
+    vec3 position;
+    vec3 velocity;
+    vec4 color;
+};
+
+//* Compact HR particle, 16 instead of 48 bytes
+//* x: cell of size h_LR, 8 bit biased per axis, palette index in the top 8 bits
+//* y: unorm16 offset x, y in the cell, z: unorm16 offset z | fp16 velocity x, w: fp16 velocity y, z
+HRParticle decodeCompactHRParticle(uvec4 data, float cellSize){
+    ivec3 cell = ivec3(data.x & 0xff, (data.x >> 8) & 0xff, (data.x >> 16) & 0xff) - 128;
+    vec3 offset = vec3(unpackUnorm2x16(data.y), unpackUnorm2x16(data.z).x);
+    HRParticle p;
+    p.position = (vec3(cell) + offset) * cellSize;
+    p.velocity = vec3(unpackHalf2x16(data.z).y, unpackHalf2x16(data.w));
+    p.color = vec4(0.0);
+    return p;
+}
+
+layout(location = 7) in uvec4 inCompactParticle;
+
+layout(set = 0, binding = 1) readonly buffer HRColorPalette{
+    vec4 colors[];
+} palette;
+#else
 layout(location = 7) in vec3 inPosition;
 layout(location = 8) in vec3 inVelocity;
 layout(location = 9) in vec4 inColor;
+#endif
 
 layout(location = 0) out vec3 outNormal;
 layout(location = 1) out vec3 eye;
@@ -58,6 +86,12 @@ layout(location = 3) out vec3 outPosition;
 layout(location = 9) out vec4 outColor;
 
 void main() {
+#ifdef COMPACT_HR_PARTICLES
+    HRParticle particle = decodeCompactHRParticle(inCompactParticle, settings.h_LR);
+    vec3 inPosition = particle.position;
+    vec3 inVelocity = particle.velocity;
+    vec4 inColor = palette.colors[inCompactParticle.x >> 24];
+#endif
     gl_PointSize = 1;
     // vec3 scale = inVelocity; // LR
     // vec3 scale = vec3(settings.r_LR); // LR
@@ -0,0 +1,28 @@
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_ENABLE_EXPERIMENTAL
+
+#include <iostream>
+#include <string>
+
+#include "headless_application.h"
+
+//* Offline batch runner: fixed timestep, fixed frame count, no rendering
+//* Usage: GranularMatterBatch [--scene S] [--dt DT] [--substeps N|auto] [--frames N] [--grid hash|dense] [--hash-table-size N] [--hr-format full|compact] [--kernels separate|fused] [--sleeping on|off] [--stiffness-tolerance T] [--commands record|replay] [--hr-advection inline|pipelined] [--volume-map-cache DIR|off] [--volume-map-bake cpu|gpu|compare] [--volume-map-resolution N] [--volume-maps dense|sparse] [--volume-map-format f32|f16|octahedral] [--volume-map-validation on|off]
+
+int main(int argc, char* argv[]) {
+    HeadlessOptions options;
+    OptionsResult result = parseHeadlessOptions(argc, argv, options, nullptr);
+    if(result != OptionsResult::eRun){
+        return result == OptionsResult::eHelp ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    try {
+        HeadlessApplication app(options);
+        app.run();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -23,7 +23,7 @@ ComputePass::ComputePass(gpu::Core *core, std::string shaderFile, std::vector<vk
     vk::Result result;
 
     std::vector<vk::SpecializationMapEntry> entries;
-    std::vector<vk::SpecializationMapEntry> data;
+    std::vector<uint32_t> data;
     uint32_t offset = 0;
     uint32_t sizeOfConstant = sizeof(int32_t);
     for (auto spec : specializations)
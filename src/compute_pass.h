@@ -1,3 +1,4 @@
+#pragma once
 #include "core.h"
 namespace gpu {
     struct SpecializationConstant{
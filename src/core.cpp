@@ -3,6 +3,8 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
 
 #define MAX_VARIABLE_DESCRIPTOR_COUNT 32
 
@@ -16,6 +18,10 @@ bool QueueFamilyIndices::isComplete() {
 	return graphicsFamily.has_value() && presentFamily.has_value() && computeFamily.has_value();
 }
 
+bool QueueFamilyIndices::isComputeComplete() {
+	return computeFamily.has_value();
+}
+
 std::string trim(const std::string& line)
 {
     const char* WhiteSpace = " \t\v\r\n";
@@ -50,12 +56,32 @@ Core::Core(bool enableValidation, Window* window){
     createLogicalDevice();
     createAllocator();
     createCommandPool();
+    createTimeline();
 
     int width, height;
     window->getSize(&width, &height);
     createSwapchain(width, height);
 }
 
+Core::Core(bool enableValidation){
+    _enableValidation = enableValidation;
+    _headless = true;
+    _deviceExtensions.erase(std::remove_if(_deviceExtensions.begin(), _deviceExtensions.end(), [](const char* extension){
+        return strcmp(extension, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0;
+    }), _deviceExtensions.end());
+    createInstance();
+
+    if(_enableValidation){
+        createDebugMessenger();
+    }
+
+    pickPhysicalDevice();
+    createLogicalDevice();
+    createAllocator();
+    createCommandPool();
+    createTimeline();
+}
+
 uint32_t gpu::Core::getIdealWorkGroupSize()
 {
     uint32_t vendorID = _physicalDevice.getProperties().vendorID;
@@ -96,6 +122,29 @@ void Core::pickPhysicalDevice() {
 bool Core::isDeviceSuitable(vk::PhysicalDevice pDevice) {
     QueueFamilyIndices indices = findQueueFamilies(pDevice);
     bool extensionsSupported = checkDeviceExtensionSupport(pDevice);
+
+    //* Reductions in the pressure solve use subgroup arithmetic
+    auto subgroupProperties = pDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceSubgroupProperties>().get<vk::PhysicalDeviceSubgroupProperties>();
+    bool supportsSubgroupArithmetic =
+        (subgroupProperties.supportedStages & vk::ShaderStageFlagBits::eCompute) &&
+        (subgroupProperties.supportedOperations & vk::SubgroupFeatureFlagBits::eArithmetic);
+
+    if(_headless){
+        //* Only the features used by the simulation compute passes are required
+        auto computeFeatures = pDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceBufferDeviceAddressFeatures, vk::PhysicalDeviceDescriptorIndexingFeatures, vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT, vk::PhysicalDeviceTimelineSemaphoreFeatures>();
+        bool supportsComputeFeatures =
+            computeFeatures.get<vk::PhysicalDeviceFeatures2>().features.shaderSampledImageArrayDynamicIndexing &&
+            computeFeatures.get<vk::PhysicalDeviceBufferDeviceAddressFeatures>().bufferDeviceAddress &&
+            computeFeatures.get<vk::PhysicalDeviceDescriptorIndexingFeatures>().runtimeDescriptorArray &&
+            computeFeatures.get<vk::PhysicalDeviceDescriptorIndexingFeatures>().descriptorBindingVariableDescriptorCount &&
+            computeFeatures.get<vk::PhysicalDeviceDescriptorIndexingFeatures>().descriptorBindingPartiallyBound &&
+            computeFeatures.get<vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT>().shaderBufferFloat32Atomics &&
+            computeFeatures.get<vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT>().shaderBufferFloat32AtomicAdd &&
+            computeFeatures.get<vk::PhysicalDeviceTimelineSemaphoreFeatures>().timelineSemaphore;
+
+        return indices.isComputeComplete() && extensionsSupported && supportsComputeFeatures && supportsSubgroupArithmetic;
+    }
+
     bool swapchainAdequate = false;
     
     if (extensionsSupported) {
@@ -103,7 +152,7 @@ bool Core::isDeviceSuitable(vk::PhysicalDevice pDevice) {
         swapchainAdequate = !swapchainSupport.formats.empty() && !swapchainSupport.presentModes.empty();
     }
 
-    auto m_deviceFeatures2 = pDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceRayTracingPipelineFeaturesKHR, vk::PhysicalDeviceAccelerationStructureFeaturesKHR, vk::PhysicalDeviceBufferDeviceAddressFeatures, vk::PhysicalDeviceDescriptorIndexingFeatures, vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT>();
+    auto m_deviceFeatures2 = pDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceRayTracingPipelineFeaturesKHR, vk::PhysicalDeviceAccelerationStructureFeaturesKHR, vk::PhysicalDeviceBufferDeviceAddressFeatures, vk::PhysicalDeviceDescriptorIndexingFeatures, vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT, vk::PhysicalDeviceTimelineSemaphoreFeatures>();
     bool supportsAllFeatures =
         m_deviceFeatures2.get<vk::PhysicalDeviceFeatures2>().features.samplerAnisotropy &&
         m_deviceFeatures2.get<vk::PhysicalDeviceFeatures2>().features.geometryShader &&
@@ -117,9 +166,10 @@ bool Core::isDeviceSuitable(vk::PhysicalDevice pDevice) {
         m_deviceFeatures2.get<vk::PhysicalDeviceDescriptorIndexingFeatures>().descriptorBindingVariableDescriptorCount && 
         m_deviceFeatures2.get<vk::PhysicalDeviceDescriptorIndexingFeatures>().descriptorBindingPartiallyBound &&
         m_deviceFeatures2.get<vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT>().shaderBufferFloat32Atomics &&
-        m_deviceFeatures2.get<vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT>().shaderBufferFloat32AtomicAdd;
+        m_deviceFeatures2.get<vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT>().shaderBufferFloat32AtomicAdd &&
+        m_deviceFeatures2.get<vk::PhysicalDeviceTimelineSemaphoreFeatures>().timelineSemaphore;
 
-    return indices.isComplete() && extensionsSupported && swapchainAdequate && supportsAllFeatures;
+    return indices.isComplete() && extensionsSupported && swapchainAdequate && supportsAllFeatures && supportsSubgroupArithmetic;
 }
 
 QueueFamilyIndices Core::findQueueFamilies(vk::PhysicalDevice pDevice) {
@@ -132,6 +182,12 @@ QueueFamilyIndices Core::findQueueFamilies(vk::PhysicalDevice pDevice) {
         if (queueFamilies[i].queueFlags & vk::QueueFlagBits::eCompute && queueFamilies[i].timestampValidBits > 0) {
             indices.computeFamily = i;
         }
+        if (_headless) {
+            if (indices.isComputeComplete()) {
+                break;
+            }
+            continue;
+        }
         if (pDevice.getSurfaceSupportKHR(i, *_surface)) {
             indices.presentFamily = i;
         }
@@ -180,10 +236,18 @@ SwapchainSupportDetails Core::querySwapchainSupport(vk::PhysicalDevice pDevice)
 void Core::createLogicalDevice(){
     QueueFamilyIndices indices = findQueueFamilies(_physicalDevice);
     std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
-    std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
-    float queuePriority = 1.0f;
+    std::set<uint32_t> uniqueQueueFamilies;
+    if(_headless){
+        uniqueQueueFamilies = {indices.computeFamily.value()};
+    }
+    else{
+        uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value(), indices.computeFamily.value()};
+    }
+    //* A second queue of the compute family runs async work next to the main chain, no ownership transfers are needed within a family
+    uint32_t computeQueueCount = std::min(2u, _physicalDevice.getQueueFamilyProperties()[indices.computeFamily.value()].queueCount);
+    std::array<float, 2> queuePriorities = { 1.0f, 1.0f };
     for (uint32_t queueFamily : uniqueQueueFamilies) {
-        vk::DeviceQueueCreateInfo queueCreateInfo({}, queueFamily, 1, &queuePriority);
+        vk::DeviceQueueCreateInfo queueCreateInfo({}, queueFamily, queueFamily == indices.computeFamily.value() ? computeQueueCount : 1, queuePriorities.data());
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
@@ -203,14 +267,33 @@ void Core::createLogicalDevice(){
 	{
 		deviceCreateInfo = vk::DeviceCreateInfo({}, queueCreateInfos, {}, _deviceExtensions, {});
 	}
-    vk::StructureChain<vk::DeviceCreateInfo, vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceRayTracingPipelineFeaturesKHR, vk::PhysicalDeviceAccelerationStructureFeaturesKHR, vk::PhysicalDeviceBufferDeviceAddressFeatures, vk::PhysicalDeviceDescriptorIndexingFeatures, vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT> deviceFeatureCreateInfo = {
+
+    if(_headless){
+        vk::StructureChain<vk::DeviceCreateInfo, vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceBufferDeviceAddressFeatures, vk::PhysicalDeviceDescriptorIndexingFeatures, vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT, vk::PhysicalDeviceTimelineSemaphoreFeatures> computeFeatureCreateInfo = {
+            deviceCreateInfo,
+            vk::PhysicalDeviceFeatures2().setFeatures(vk::PhysicalDeviceFeatures().setShaderSampledImageArrayDynamicIndexing(true)),
+            vk::PhysicalDeviceBufferDeviceAddressFeatures().setBufferDeviceAddress(true),
+            vk::PhysicalDeviceDescriptorIndexingFeatures().setRuntimeDescriptorArray(true).setShaderSampledImageArrayNonUniformIndexing(true).setDescriptorBindingVariableDescriptorCount(true).setDescriptorBindingPartiallyBound(true),
+            vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT().setShaderBufferFloat32Atomics(true).setShaderBufferFloat32AtomicAdd(true),
+            vk::PhysicalDeviceTimelineSemaphoreFeatures().setTimelineSemaphore(true)
+        };
+
+        _device = _physicalDevice.createDeviceUnique(computeFeatureCreateInfo.get<vk::DeviceCreateInfo>());
+
+        computeQueue = _device->getQueue(indices.computeFamily.value(), 0);
+        asyncComputeQueue = _device->getQueue(indices.computeFamily.value(), computeQueueCount - 1);
+        return;
+    }
+
+    vk::StructureChain<vk::DeviceCreateInfo, vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceRayTracingPipelineFeaturesKHR, vk::PhysicalDeviceAccelerationStructureFeaturesKHR, vk::PhysicalDeviceBufferDeviceAddressFeatures, vk::PhysicalDeviceDescriptorIndexingFeatures, vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT, vk::PhysicalDeviceTimelineSemaphoreFeatures> deviceFeatureCreateInfo = {
 		deviceCreateInfo,
 		vk::PhysicalDeviceFeatures2().setFeatures(vk::PhysicalDeviceFeatures().setSamplerAnisotropy(true).setGeometryShader(true).setShaderSampledImageArrayDynamicIndexing(true).setFillModeNonSolid(true)),
 		vk::PhysicalDeviceRayTracingPipelineFeaturesKHR().setRayTracingPipeline(true),
 		vk::PhysicalDeviceAccelerationStructureFeaturesKHR().setAccelerationStructure(true),
 		vk::PhysicalDeviceBufferDeviceAddressFeatures().setBufferDeviceAddress(true),
 		vk::PhysicalDeviceDescriptorIndexingFeatures().setRuntimeDescriptorArray(true).setShaderSampledImageArrayNonUniformIndexing(true).setDescriptorBindingVariableDescriptorCount(true).setDescriptorBindingPartiallyBound(true),
-        vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT().setShaderBufferFloat32Atomics(true).setShaderBufferFloat32AtomicAdd(true)
+        vk::PhysicalDeviceShaderAtomicFloatFeaturesEXT().setShaderBufferFloat32Atomics(true).setShaderBufferFloat32AtomicAdd(true),
+        vk::PhysicalDeviceTimelineSemaphoreFeatures().setTimelineSemaphore(true)
 	};
 
     _device = _physicalDevice.createDeviceUnique(deviceFeatureCreateInfo.get<vk::DeviceCreateInfo>());
@@ -218,6 +301,7 @@ void Core::createLogicalDevice(){
 
     graphicsQueue = _device->getQueue(indices.graphicsFamily.value(), 0);
     computeQueue = _device->getQueue(indices.computeFamily.value(), 0);
+    asyncComputeQueue = _device->getQueue(indices.computeFamily.value(), computeQueueCount - 1);
     presentQueue = _device->getQueue(indices.presentFamily.value(), 0);
 }
 
@@ -237,18 +321,24 @@ void gpu::Core::createInstance()
     if (_enableValidation && !checkValidationLayerSupport()) {
 		throw std::runtime_error("validation layers requested, but not available!");
 	}
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	std::vector<const char*> extensions;
+    if(!_headless){
+        uint32_t glfwExtensionCount = 0;
+        const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        extensions = std::vector<const char*>(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    }
 
     extensions.push_back("VK_EXT_debug_utils");
     extensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
 
-	vk::ApplicationInfo applicationInfo("VulkanBase", VK_MAKE_VERSION(0, 0 ,1), "VulkanEngine", 1, VK_API_VERSION_1_1);
+	vk::ApplicationInfo applicationInfo("VulkanBase", VK_MAKE_VERSION(0, 0 ,1), "VulkanEngine", 1, VK_API_VERSION_1_2);
+
+    //* Only request the validation layers when enabled, render nodes usually do not ship them
+    uint32_t layerCount = _enableValidation ? static_cast<uint32_t>(_validationLayers.size()) : 0;
 
     _instance = vk::createInstanceUnique(vk::InstanceCreateInfo{
         vk::InstanceCreateFlags{ VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR }, &applicationInfo, 
-        static_cast<uint32_t>(_validationLayers.size()), _validationLayers.data(),
+        layerCount, _validationLayers.data(),
         static_cast<uint32_t>(extensions.size()), extensions.data() 
     });
 
@@ -365,9 +455,10 @@ void Core::endSingleTimeCommands(vk::CommandBuffer commandBuffer) {
 
     commandBuffer.end();
 
+    vk::Queue queue = _headless ? computeQueue : graphicsQueue;
     vk::SubmitInfo submitInfoCopy({}, {}, commandBuffer, {});
-    graphicsQueue.submit(submitInfoCopy, {});
-    graphicsQueue.waitIdle();
+    queue.submit(submitInfoCopy, {});
+    queue.waitIdle();
     _device->freeCommandBuffers(*_commandPool, 1, &commandBuffer);
 }
 
@@ -571,7 +662,8 @@ vk::RenderPass gpu::Core::createColorDepthRenderPass(vk::AttachmentLoadOp loadOp
 
 void Core::createCommandPool() {
     QueueFamilyIndices queueFamilyIndices = findQueueFamilies(_physicalDevice);
-    vk::CommandPoolCreateInfo poolInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queueFamilyIndices.graphicsFamily.value());
+    uint32_t queueFamily = _headless ? queueFamilyIndices.computeFamily.value() : queueFamilyIndices.graphicsFamily.value();
+    vk::CommandPoolCreateInfo poolInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queueFamily);
     _commandPool = _device->createCommandPoolUnique(poolInfo);
 }
 
@@ -698,6 +790,10 @@ vk::Image gpu::Core::image3DFromData(void *data, vk::ImageUsageFlags imageUsage,
         case vk::Format::eR32G32B32A32Sfloat:
             formatSize = 4 * 4;
             break;
+        case vk::Format::eR16G16B16A16Sfloat:
+        case vk::Format::eR16G16B16A16Snorm:
+            formatSize = 4 * 2;
+            break;
         default:
             break;
     }
@@ -708,7 +804,7 @@ vk::Image gpu::Core::image3DFromData(void *data, vk::ImageUsageFlags imageUsage,
         
     transitionImageLayout(image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer);
     copyBufferToImage(stagingBuffer, image, static_cast<uint32_t>(width), static_cast<uint32_t>(height), static_cast<uint32_t>(depth));
-    transitionImageLayout(image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader);
+    transitionImageLayout(image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader);
 
     destroyBuffer(stagingBuffer);
     
@@ -965,7 +1061,7 @@ vk::ShaderModule Core::createShaderModule(const std::vector<uint32_t> code) {
     return _device->createShaderModule(createInfo);
 }
 
-vk::ShaderModule Core::loadShaderModule(std::string src) {
+vk::ShaderModule Core::loadShaderModule(std::string src, std::vector<std::string> defines) {
 
     auto fileExtension = src.substr(src.find_last_of('.'));
 
@@ -994,7 +1090,7 @@ vk::ShaderModule Core::loadShaderModule(std::string src) {
     //  std::cout << "Compiled a vertex shader resulting in preprocessed text:" << std::endl  << preprocessed << std::endl;
 
     std::cout << "Compiling shader  " << src << "" << std::endl;
-    auto spirv = compile_file("shader_src", stage, shaderCodeGlsl.c_str()); //, shaderc_optimization_level_performance
+    auto spirv = compile_file("shader_src", stage, shaderCodeGlsl.c_str(), defines); //, shaderc_optimization_level_performance
 
     return createShaderModule(spirv);
 }
@@ -1074,4 +1170,64 @@ void gpu::Core::destroyComputeContext(ComputeContext& context)
         _device->destroySemaphore(frame._computeFinished);
         _device->destroyFence(frame._inFlight);
     }
+}
+
+void gpu::Core::createTimeline()
+{
+    vk::StructureChain<vk::SemaphoreCreateInfo, vk::SemaphoreTypeCreateInfo> createInfo = {
+        vk::SemaphoreCreateInfo(),
+        vk::SemaphoreTypeCreateInfo(vk::SemaphoreType::eTimeline, 0)
+    };
+    _timeline = _device->createSemaphoreUnique(createInfo.get<vk::SemaphoreCreateInfo>());
+    _timelineValue = 0;
+    _asyncTimeline = _device->createSemaphoreUnique(createInfo.get<vk::SemaphoreCreateInfo>());
+    _asyncTimelineValue = 0;
+}
+
+uint64_t gpu::Core::submitTimeline(vk::Queue queue, vk::ArrayProxy<const vk::CommandBuffer> commandBuffers, vk::PipelineStageFlags waitStage, vk::Fence fence)
+{
+    vk::Semaphore timeline = *_timeline;
+    uint64_t waitValue = _timelineValue;
+    uint64_t signalValue = ++_timelineValue;
+
+    //* Waits for the previous submit on the timeline, so the submits execute in the order they are queued
+    vk::TimelineSemaphoreSubmitInfo timelineSubmitInfo(1, &waitValue, 1, &signalValue);
+    vk::SubmitInfo submitInfo(1, &timeline, &waitStage, commandBuffers.size(), commandBuffers.data(), 1, &timeline, &timelineSubmitInfo);
+
+    queue.submit(submitInfo, fence);
+    return signalValue;
+}
+
+uint64_t gpu::Core::submitAsyncTimeline(vk::ArrayProxy<const vk::CommandBuffer> commandBuffers, uint64_t waitValue, vk::PipelineStageFlags waitStage, vk::Fence fence)
+{
+    std::array<vk::Semaphore, 2> waitSemaphores = { *_timeline, *_asyncTimeline };
+    std::array<uint64_t, 2> waitValues = { waitValue, _asyncTimelineValue };
+    std::array<vk::PipelineStageFlags, 2> waitStages = { waitStage, waitStage };
+    vk::Semaphore asyncTimeline = *_asyncTimeline;
+    uint64_t signalValue = ++_asyncTimelineValue;
+
+    //* Only ordered behind the given value of the main timeline and the previous async submit, later main submits do not wait for it
+    vk::TimelineSemaphoreSubmitInfo timelineSubmitInfo((uint32_t)waitValues.size(), waitValues.data(), 1, &signalValue);
+    vk::SubmitInfo submitInfo((uint32_t)waitSemaphores.size(), waitSemaphores.data(), waitStages.data(), commandBuffers.size(), commandBuffers.data(), 1, &asyncTimeline, &timelineSubmitInfo);
+
+    asyncComputeQueue.submit(submitInfo, fence);
+    return signalValue;
+}
+
+void gpu::Core::waitTimeline(uint64_t value)
+{
+    vk::Semaphore timeline = *_timeline;
+    vk::Result result = _device->waitSemaphores(vk::SemaphoreWaitInfo({}, 1, &timeline, &value), UINT64_MAX);
+    if(result != vk::Result::eSuccess){
+        throw std::runtime_error("failed to wait for timeline semaphore!");
+    }
+}
+
+void gpu::Core::waitAsyncTimeline(uint64_t value)
+{
+    vk::Semaphore timeline = *_asyncTimeline;
+    vk::Result result = _device->waitSemaphores(vk::SemaphoreWaitInfo({}, 1, &timeline, &value), UINT64_MAX);
+    if(result != vk::Result::eSuccess){
+        throw std::runtime_error("failed to wait for async timeline semaphore!");
+    }
 }
\ No newline at end of file
@@ -24,6 +24,7 @@ namespace gpu
         std::optional<uint32_t> presentFamily;
         std::optional<uint32_t> computeFamily;
         bool isComplete();
+        bool isComputeComplete();
     };
 
     struct SwapchainSupportDetails {
@@ -91,6 +92,7 @@ namespace gpu
             Core(){};
             // Core(Core &&){}
             Core(bool enableValidation, Window* window);
+            Core(bool enableValidation); // headless: compute queue only, no surface or swapchain
             ~Core(){};
             // Core& operator=(const Core&) = default;
 
@@ -104,10 +106,12 @@ namespace gpu
             inline vk::SurfaceFormatKHR getSurfaceFormat(){ return _surfaceFormat; };
             inline vk::PhysicalDevice getPhysicalDevice(){ return _physicalDevice; };
             inline vk::Device getDevice(){ return *_device; };
+            inline bool isHeadless(){ return _headless; };
             //* Queues
             inline vk::Queue getGraphicsQueue(){ return graphicsQueue; };
             inline vk::Queue getPresentQueue(){ return presentQueue; };
             inline vk::Queue getComputeQueue(){ return computeQueue; };
+            inline vk::Queue getAsyncComputeQueue(){ return asyncComputeQueue; };   //* the compute queue if its family has only one
 
             uint32_t getIdealWorkGroupSize();
 
@@ -188,11 +192,25 @@ namespace gpu
 
             //* Shaders
             vk::ShaderModule createShaderModule(const std::vector<uint32_t> code);
-            vk::ShaderModule loadShaderModule(std::string src);
+            vk::ShaderModule loadShaderModule(std::string src, std::vector<std::string> defines = {});
 
             void createComputeContext(ComputeContext& context);
             void destroyComputeContext(ComputeContext& context);
 
+            //* Timeline semaphore, every submit waits for the last value and signals the next one.
+            //* The host only waits for the value of a submit whose results it reads
+            uint64_t submitTimeline(vk::Queue queue, vk::ArrayProxy<const vk::CommandBuffer> commandBuffers, vk::PipelineStageFlags waitStage, vk::Fence fence = VK_NULL_HANDLE);
+            void waitTimeline(uint64_t value);
+            inline vk::Semaphore getTimelineSemaphore(){ return *_timeline; };
+            inline uint64_t getTimelineValue(){ return _timelineValue; };
+
+            //* Async timeline, submits on the async compute queue that overlap the main chain. They wait for a value of
+            //* the main timeline and the previous async submit
+            uint64_t submitAsyncTimeline(vk::ArrayProxy<const vk::CommandBuffer> commandBuffers, uint64_t waitValue, vk::PipelineStageFlags waitStage, vk::Fence fence = VK_NULL_HANDLE);
+            void waitAsyncTimeline(uint64_t value);
+            inline vk::Semaphore getAsyncTimelineSemaphore(){ return *_asyncTimeline; };
+            inline uint64_t getAsyncTimelineValue(){ return _asyncTimelineValue; };
+
             //* Swapchain
             void createSwapchain(uint32_t width, uint32_t height);
             void destroySwapchain();
@@ -202,6 +220,7 @@ namespace gpu
 
         private:
             bool _enableValidation = true;
+            bool _headless = false;
             std::vector<const char*> _deviceExtensions = {
                 VK_KHR_SWAPCHAIN_EXTENSION_NAME, 
                 // "VK_KHR_portability_subset",
@@ -223,9 +242,14 @@ namespace gpu
             vk::UniqueDevice _device;
             vk::Queue graphicsQueue;
             vk::Queue computeQueue;
+            vk::Queue asyncComputeQueue;
             vk::Queue presentQueue;
             vma::UniqueAllocator _allocator;
             vk::UniqueCommandPool _commandPool; 
+            vk::UniqueSemaphore _timeline;
+            uint64_t _timelineValue = 0;                    //* value signaled by the last submit
+            vk::UniqueSemaphore _asyncTimeline;
+            uint64_t _asyncTimelineValue = 0;
 
             vk::Image _swapchainDepthImage;
             vk::ImageView _swapchainDepthImageView;
@@ -244,6 +268,7 @@ namespace gpu
             void pickPhysicalDevice();
             void createLogicalDevice();
             void createAllocator();
+            void createTimeline();
             void createInstance();
             void createDebugMessenger();
             
@@ -4,6 +4,7 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <vector>
+#include <array>
 #include <string>
 #include <algorithm>
 #include <iostream>
@@ -21,6 +22,78 @@ extern float simulationSpeedFactor;
 
 extern float subTimeStep;
 extern int substeps;
+extern bool adaptiveTimestep;                           //* substeps chosen from the CFL condition, up to maxSubsteps
+extern int maxSubsteps;
+
+enum class ConvergenceCriterion : uint32_t {
+    eAverageDensityError = 0,
+    eMaxDensityError = 1,
+};
+extern ConvergenceCriterion convergenceCriterion;
+
+enum class SortBackend : uint32_t {
+    eBitonic = 0,
+    eRadix = 1,
+    eCountingSort = 2,
+};
+extern SortBackend sortBackend;
+
+//* Only read at init, the grid buffers are sized from it
+enum class GridMode : uint32_t {
+    eSpatialHash = 0,
+    eDense = 1,
+};
+extern GridMode gridMode;
+extern uint32_t hashTableSize;                          //* cells of the spatial hash table, 0: one per LR particle
+
+//* Only read at init, selects the HR particle buffer layout and the matching particle vertex shader
+enum class HRParticleFormat : uint32_t {
+    eFull = 0,                                          //* HRParticle, fp32 position, velocity and color
+    eCompact = 1,                                       //* CompactHRParticle, quantized position, fp16 velocity, palette index
+};
+extern HRParticleFormat hrParticleFormat;
+
+//* Only read at init, replaces passes that can share one neighborhood traversal by fused kernels
+extern bool fuseKernels;
+
+//* Only read at init, particles below settings.sleepingSpeed for sleepSteps substeps sleep until a neighbor moves
+extern bool sleepingParticles;
+extern uint32_t sleepSteps;
+
+//* Only read at init, relative density change that rebuilds the cached stiffness tensor of a particle
+extern float stiffnessRefreshTolerance;
+
+//* Only read at init, the substep passes from the neighbor lists to the integration are recorded once and replayed every substep
+extern bool prerecordSubsteps;
+
+//* Only read at init, the HR advection of a frame runs on the async compute queue from a snapshot of the LR state
+extern bool pipelinedHRAdvection;
+
+//* Only read at init, baked volume maps are cached here keyed on the geometry, kernel, texture size and bake backend, empty: always bake
+extern std::string volumeMapCacheDirectory;
+
+//* Only read at init, where the volume maps of triangle meshes are baked
+enum class VolumeMapBake : uint32_t {
+    eCPU = 0,
+    eGPU = 1,
+    eCompare = 2,                                       //* baked on both, the GPU result is used and the deviation printed
+};
+extern VolumeMapBake volumeMapBake;
+extern uint32_t volumeMapResolution;                    //* samples along the shortest axis of a volume map, at most 4x along the others
+
+//* Only read at init, volume maps keep only the bricks around the surface that can be sampled within h_LR
+extern bool sparseVolumeMaps;
+
+//* Texel encoding of a volume map, selected per rigid body
+enum class VolumeMapFormat : uint32_t {
+    eFloat32 = 0,                                       //* R32G32B32A32Sfloat, nearest point offset and volume
+    eFloat16 = 1,                                       //* R16G16B16A16Sfloat
+    eOctahedral = 2,                                    //* R16G16B16A16Snorm, octahedral offset direction, scaled offset length, volume
+};
+extern VolumeMapFormat volumeMapFormat;                 //* given to the rigid bodies loaded by the applications
+extern bool validateVolumeMapFormats;                   //* reports the encoding error of compact volume maps against the fp32 bake
+
+extern int particleReorderInterval;                     //* frames between reordering the LR particles, 0 disables it
 
 struct SPHSettings{
     glm::vec4 g = glm::vec4(0.f, -9.81f, 0.f, 0.f);          //* m/s^2
@@ -49,7 +122,7 @@ struct SPHSettings{
     float A_LR = r_LR * r_LR * (float)M_PI;                               
     float v_max = ((2.f * mass * glm::length(g)) / (rhoAir * A_LR * dragCoefficient));       
     float maxTimestep=0.016f;                        
-    float pad1;                        
+    uint32_t particleCount = 0;                         //* number of LR particles, set in GranularMatter::init
 };
 
 extern SPHSettings settings;
@@ -81,7 +154,13 @@ struct ShiftingArray{
 struct SimulationMetrics{
     static const uint32_t MAX_VALUES_PER_METRIC = 100;
     ShiftingArray<float> averageDensityError = ShiftingArray(100, 0.f);
+    ShiftingArray<float> maxDensityError = ShiftingArray(100, 0.f);
     ShiftingArray<int> iterationCount = ShiftingArray(100, 2);
+    std::array<float, 3> sortTime = { 0.f, 0.f, 0.f };      //* ms, last measured time per SortBackend
+    uint32_t fusedBarriersSaved = 0;                        //* per frame, compared to the unfused passes
+    uint32_t fusedTraversalsSaved = 0;                      //* neighborhood traversals per frame, compared to the unfused passes
+    uint32_t activeParticleCount = 0;                       //* awake LR particles of the last substep
+    uint32_t stiffnessRefreshCount = 0;                     //* LR particles that rebuilt their stiffness tensor in the last substep
 };
 
 extern SimulationMetrics simulationMetrics;
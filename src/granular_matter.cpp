@@ -1,21 +1,61 @@
 #include "granular_matter.h"
 #include <chrono>
+#include <bit>
+#include <numeric>
+#include <thread>
+#include <atomic>
 #include "iostream"
 #include "global.h"
 #include "utils.h"
 #include "input.h"
+#include "volume_map_cache.h"
+#include "volume_map_bake.h"
 
 SimulationMetrics simulationMetrics = SimulationMetrics();
 extern bool simulationStepForward = false;
 BitonicSortParameters params;
+SortParameters sortParams;
+PrefixSumParameters prefixSumParams;
+ParticlePassParameters particlePassParams;
+PressureSolveConvergenceParameters convergenceParams;
 uint32_t workGroupSize;
 uint32_t n;
+uint32_t sortElementCount;
 uint32_t workGroupCountSort;
 uint32_t workGroupCountLR;
 uint32_t workGroupCountHR;
+uint32_t workGroupCountKeys;
+uint32_t radixSortPassCount;
+
+const uint32_t RADIX_SORT_BITS = 8;
+const uint32_t RADIX_SORT_BUCKETS = 1 << RADIX_SORT_BITS;
+SortBackend sortBackend = SortBackend::eRadix;
+int particleReorderInterval = 10;
+bool prerecordSubsteps = false;
+bool pipelinedHRAdvection = false;
+std::string volumeMapCacheDirectory = VOLUME_MAP_CACHE_PATH;
+VolumeMapBake volumeMapBake = VolumeMapBake::eCPU;
+uint32_t volumeMapResolution = 32;
+bool sparseVolumeMaps = false;
+VolumeMapFormat volumeMapFormat = VolumeMapFormat::eFloat32;
+bool validateVolumeMapFormats = false;
+const std::array<std::string, 3> SORT_BACKEND_LABELS = { "Neighborhood list sorting (bitonic)", "Neighborhood list sorting (radix)", "Neighborhood list sorting (counting)" };
 
 int substeps = 3;
+bool adaptiveTimestep = false;
+int maxSubsteps = 16;
 float subTimeStep = 0.f;
+uint32_t maxPressureIterations = 100;
+uint32_t maxNeighbors = 64;
+GridMode gridMode = GridMode::eSpatialHash;
+uint32_t hashTableSize = 0;
+bool fuseKernels = false;
+bool sleepingParticles = false;
+uint32_t sleepSteps = 30;
+float stiffnessRefreshTolerance = 0.05f;
+HRParticleFormat hrParticleFormat = HRParticleFormat::eFull;
+glm::ivec3 gridResolution;
+ConvergenceCriterion convergenceCriterion = ConvergenceCriterion::eAverageDensityError;
 
 glm::ivec3 computeSpace = glm::ivec3(16, 32, 16);
 
@@ -57,7 +97,7 @@ void GranularMatter::init(){
         {0, 0, -settings.r_LR},
     };
 
-    std::vector<glm::vec4> colorPalette = {
+    colorPalette = {
         glm::vec4(246.f / 255.f, 215.f / 255.f, 176.f / 255.f, 1.0),
         glm::vec4(246.f / 255.f, 215.f / 255.f, 176.f / 255.f, 1.0),
         glm::vec4(246.f / 255.f, 215.f / 255.f, 176.f / 255.f, 1.0),
@@ -127,21 +167,129 @@ void GranularMatter::init(){
         }
     }
     
-    particleCells.resize(lrParticles.size());
+    //* Dense grid: cells of size h_LR covering the domain, spatial hash: hashTableSize cells (one per particle by default)
+    gridResolution = glm::ivec3(
+        (int)std::ceil(settings.DOMAIN_WIDTH / settings.h_LR),
+        (int)std::ceil(settings.DOMAIN_HEIGHT / settings.h_LR),
+        (int)std::ceil(settings.DOMAIN_WIDTH / settings.h_LR)
+    );
+    uint32_t cellCount = (uint32_t)lrParticles.size();
+    if(gridMode == GridMode::eDense){
+        cellCount = (uint32_t)(gridResolution.x * gridResolution.y * gridResolution.z);
+    }
+    else if(hashTableSize > 0){
+        cellCount = hashTableSize;
+    }
+    cellRanges.resize(cellCount);
+    std::fill(cellRanges.begin(), cellRanges.end(), glm::uvec2(0));
+
+    n = (uint32_t)lrParticles.size();
+    settings.particleCount = n;
+    std::cout << "LRParticle count: " << n << std::endl;
+    std::cout << "HRParticle count: " << n * settings.n_HR << std::endl;
+    std::cout << "Grid cell count: " << cellCount << (gridMode == GridMode::eDense ? " (dense)" : " (spatial hash)") << std::endl;
+
+    //* Dispatches are rounded up, the passes skip invocations past the particle count
+    workGroupSize = _core->getIdealWorkGroupSize();
+
+    //* Bitonic sort needs a power of two elements, the padding entries keep the UINT32_MAX sentinel key and sort behind all particles
+    sortElementCount = std::max(std::bit_ceil(n), workGroupSize * 2);
+    particleCells.resize(sortElementCount);
     std::fill(particleCells.begin(), particleCells.end(), ParticleGridEntry());
-    startingIndices.resize(lrParticles.size());
-    std::fill(startingIndices.begin(), startingIndices.end(), UINT32_MAX);
+
+    workGroupCountSort = sortElementCount / ( workGroupSize * 2 );
+    workGroupCountLR = (n + workGroupSize - 1) / workGroupSize;
+    workGroupCountHR = ((uint32_t)hrParticles.size() + workGroupSize - 1) / workGroupSize;
+
+    //* Cell keys are below the cell count, so only the bits below it have to be sorted
+    workGroupCountKeys = (n + workGroupSize - 1) / workGroupSize;
+    radixSortPassCount = std::max(1u, ((uint32_t)std::bit_width(cellCount - 1) + RADIX_SORT_BITS - 1) / RADIX_SORT_BITS);
 
     additionalDataBuffer.resize(gpu::MAX_FRAMES_IN_FLIGHT);
     for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
-        additionalDataBuffer[i] = _core->bufferFromData(&additionalData,  sizeof(AdditionalData), vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferHost, vma::AllocationCreateFlagBits::eHostAccessSequentialWrite );
+        additionalDataBuffer[i] = _core->bufferFromData(&additionalData,  sizeof(AdditionalData), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eAutoPreferHost, vma::AllocationCreateFlagBits::eHostAccessRandom );
+    }
+
+    //* AdditionalData of every substep of a frame, grown when a frame runs more substeps
+    substepHistoryBuffers.resize(gpu::MAX_FRAMES_IN_FLIGHT);
+    substepHistoryCapacities.resize(gpu::MAX_FRAMES_IN_FLIGHT);
+    substepHistoryCounts.resize(gpu::MAX_FRAMES_IN_FLIGHT, 0);
+    substepSegmentCommandBuffers.resize(gpu::MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
+        substepHistoryCapacities[i] = (uint32_t)std::max(maxSubsteps, substeps);
+        substepHistoryBuffers[i] = _core->createBuffer(sizeof(AdditionalData) * substepHistoryCapacities[i], vk::BufferUsageFlagBits::eTransferDst, vma::MemoryUsage::eAutoPreferHost, vma::AllocationCreateFlagBits::eHostAccessRandom);
+    }
+
+    vk::DispatchIndirectCommand pressureSolveDispatch(0, 1, 1);
+    pressureSolveDispatchBuffers.resize(gpu::MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
+        pressureSolveDispatchBuffers[i] = _core->bufferFromData(&pressureSolveDispatch, sizeof(vk::DispatchIndirectCommand), vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, vma::MemoryUsage::eAutoPreferDevice);
+    }
+
+    settingsBuffers.resize(gpu::MAX_FRAMES_IN_FLIGHT);
+    convergenceParamsBuffers.resize(gpu::MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
+        settingsBuffers[i] = _core->bufferFromData(&settings, sizeof(SPHSettings), vk::BufferUsageFlagBits::eUniformBuffer, vma::MemoryUsage::eAutoPreferHost, vma::AllocationCreateFlagBits::eHostAccessSequentialWrite);
+        convergenceParamsBuffers[i] = _core->bufferFromData(&convergenceParams, sizeof(PressureSolveConvergenceParameters), vk::BufferUsageFlagBits::eUniformBuffer, vma::MemoryUsage::eAutoPreferHost, vma::AllocationCreateFlagBits::eHostAccessSequentialWrite);
+    }
+
+    ActiveParticlesHeader activeParticlesHeader;
+    activeParticlesBuffers.resize(gpu::MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
+        activeParticlesBuffers[i] = _core->createBuffer(sizeof(ActiveParticlesHeader) + sizeof(uint32_t) * n, vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eAutoPreferDevice);
+        _core->updateBufferData(activeParticlesBuffers[i], &activeParticlesHeader, sizeof(ActiveParticlesHeader));
+    }
+
+    std::vector<glm::vec2> densityErrorPartials(workGroupCountLR, glm::vec2(0.0));
+    densityErrorPartialsBuffers.resize(gpu::MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
+        densityErrorPartialsBuffers[i] = _core->bufferFromData(densityErrorPartials.data(), sizeof(glm::vec2) * densityErrorPartials.size(), vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferDevice);
     }
 
     particlesBufferB = _core->bufferFromData(lrParticles.data(),sizeof(LRParticle) * lrParticles.size(),vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eAutoPreferDevice);
-    particlesBufferHR = _core->bufferFromData(hrParticles.data(),sizeof(HRParticle) * hrParticles.size(),vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eAutoPreferDevice);
+    particlesBufferHR = _core->createBuffer(hrParticleSize() * hrParticles.size(),vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eAutoPreferDevice);
+    uploadHRParticles(hrParticles);
+    colorPaletteBuffer = _core->bufferFromData(colorPalette.data(), sizeof(glm::vec4) * colorPalette.size(), vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferDevice);
     
-    particleCellBuffer = _core->bufferFromData(particleCells.data(), sizeof(ParticleGridEntry) * particleCells.size(),vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferDevice);
-    startingIndicesBuffers = _core->bufferFromData(startingIndices.data(), sizeof(uint32_t) * startingIndices.size(),vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferDevice);
+    particleCellBuffer = _core->bufferFromData(particleCells.data(), sizeof(ParticleGridEntry) * particleCells.size(),vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eAutoPreferDevice);
+    cellRangesBuffer = _core->bufferFromData(cellRanges.data(), sizeof(glm::uvec2) * cellRanges.size(),vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eAutoPreferDevice);
+
+    sortTempBuffer = _core->bufferFromData(particleCells.data(), sizeof(ParticleGridEntry) * particleCells.size(), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eAutoPreferDevice);
+    std::vector<uint32_t> radixHistograms(RADIX_SORT_BUCKETS * workGroupCountKeys, 0);
+    radixHistogramBuffer = _core->bufferFromData(radixHistograms.data(), sizeof(uint32_t) * radixHistograms.size(), vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferDevice);
+    std::vector<uint32_t> cellCounts(cellRanges.size(), 0);
+    cellCountsBuffer = _core->bufferFromData(cellCounts.data(), sizeof(uint32_t) * cellCounts.size(), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, vma::MemoryUsage::eAutoPreferDevice);
+
+    particleIds.resize(lrParticles.size());
+    std::iota(particleIds.begin(), particleIds.end(), 0);
+    particleIdsBuffer = _core->bufferFromData(particleIds.data(), sizeof(uint32_t) * particleIds.size(), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eAutoPreferDevice);
+    particleIdsReorderBuffer = _core->bufferFromData(particleIds.data(), sizeof(uint32_t) * particleIds.size(), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eAutoPreferDevice);
+    //* Neighbor lists are rebuilt every substep, no initial data needed
+    std::vector<uint32_t> neighborCounts(n, 0);
+    neighborCountsBuffer = _core->bufferFromData(neighborCounts.data(), sizeof(uint32_t) * neighborCounts.size(), vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferDevice);
+    neighborsBuffer = _core->createBuffer(sizeof(uint32_t) * n * maxNeighbors, vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferDevice);
+    neighborGradWBuffer = _core->createBuffer(sizeof(glm::vec4) * n * maxNeighbors, vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferDevice);
+
+    for (size_t stream = 0; stream < LRParticleStream::eStreamCount; stream++) {
+        particleStreamBuffers[stream] = _core->createBuffer(LR_PARTICLE_STREAM_SIZES[stream] * n, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eAutoPreferDevice);
+        particleStreamReorderBuffers[stream] = _core->createBuffer(LR_PARTICLE_STREAM_SIZES[stream] * n, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eAutoPreferDevice);
+    }
+    uploadLRParticles(lrParticles);
+
+    //* LR state the pipelined HR advection of a frame reads, copied after the last substep so the next frame can overwrite the live buffers
+    if(pipelinedHRAdvection){
+        snapshotKinematicsBuffers.resize(gpu::MAX_FRAMES_IN_FLIGHT);
+        snapshotDensityBuffers.resize(gpu::MAX_FRAMES_IN_FLIGHT);
+        snapshotParticleCellBuffers.resize(gpu::MAX_FRAMES_IN_FLIGHT);
+        snapshotCellRangesBuffers.resize(gpu::MAX_FRAMES_IN_FLIGHT);
+        for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
+            snapshotKinematicsBuffers[i] = _core->createBuffer(LR_PARTICLE_STREAM_SIZES[LRParticleStream::eKinematics] * n, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, vma::MemoryUsage::eAutoPreferDevice);
+            snapshotDensityBuffers[i] = _core->createBuffer(LR_PARTICLE_STREAM_SIZES[LRParticleStream::eDensity] * n, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, vma::MemoryUsage::eAutoPreferDevice);
+            snapshotParticleCellBuffers[i] = _core->createBuffer(sizeof(ParticleGridEntry) * particleCells.size(), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, vma::MemoryUsage::eAutoPreferDevice);
+            snapshotCellRangesBuffers[i] = _core->createBuffer(sizeof(glm::uvec2) * cellRanges.size(), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, vma::MemoryUsage::eAutoPreferDevice);
+        }
+        hrAdvectionTimelineValues.resize(gpu::MAX_FRAMES_IN_FLIGHT, 0);
+    }
     
     initFrameResources();
     createDescriptorPool();
@@ -161,39 +309,57 @@ void GranularMatter::init(){
         descriptorSetLayoutGrid
     };
 
-    n = (uint32_t)particleCells.size();
-    std::cout << "LRParticle count: " << n << std::endl;
-    std::cout << "HRParticle count: " << n * settings.n_HR << std::endl;
-
-    workGroupSize = 1;
-    if(n < _core->getIdealWorkGroupSize() * 2){
-        workGroupSize = n / 2;
-    }
-    else{
-        workGroupSize = _core->getIdealWorkGroupSize();
-    }
+    //* Grid mode and dense grid resolution for every pass that computes cell keys
+    std::vector<gpu::SpecializationConstant> gridSpecializations{
+        gpu::SpecializationConstant(1, workGroupSize),
+        gpu::SpecializationConstant(3, static_cast<uint32_t>(gridMode)),
+        gpu::SpecializationConstant(4, (uint32_t)gridResolution.x),
+        gpu::SpecializationConstant(5, (uint32_t)gridResolution.y),
+        gpu::SpecializationConstant(6, (uint32_t)gridResolution.z),
+        gpu::SpecializationConstant(9, (uint32_t)sleepingParticles),
+        gpu::SpecializationConstant(10, sleepSteps)
+    };
+    std::vector<gpu::SpecializationConstant> neighborListSpecializations = gridSpecializations;
+    neighborListSpecializations.push_back(gpu::SpecializationConstant(2, maxNeighbors));
 
-    workGroupCountSort = n / ( workGroupSize * 2 );
-    workGroupCountLR = n / workGroupSize;
-    workGroupCountHR = (uint32_t)hrParticles.size() / workGroupSize;
-    initPass = gpu::ComputePass(_core, SHADER_PATH"/init.comp", descriptorSetLayoutsParticleCell, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SPHSettings));
+    initPass = gpu::ComputePass(_core, SHADER_PATH"/init.comp", descriptorSetLayoutsParticleCell, gridSpecializations);
     bitonicSortPass = gpu::ComputePass(_core, SHADER_PATH"/bitonic_sort.comp", descriptorSetLayoutsCell, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(BitonicSortParameters));
-    startingIndicesPass = gpu::ComputePass(_core, SHADER_PATH"/start_indices.comp", descriptorSetLayoutsCell, { gpu::SpecializationConstant(1, workGroupSize) }); 
-
-    computeDensityPass = gpu::ComputePass(_core, SHADER_PATH"/compute_density.comp", descriptorSetLayoutsParticleCell, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SPHSettings));
-    computeSurfaceNormalPass = gpu::ComputePass(_core, SHADER_PATH"/compute_surface_normal.comp", descriptorSetLayoutsParticleCell, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SPHSettings));
+    radixHistogramPass = gpu::ComputePass(_core, SHADER_PATH"/radix_histogram.comp", { descriptorSetLayoutRadixSort }, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SortParameters));
+    prefixSumPass = gpu::ComputePass(_core, SHADER_PATH"/prefix_sum.comp", { descriptorSetLayoutPrefixSum }, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(PrefixSumParameters));
+    radixScatterPass = gpu::ComputePass(_core, SHADER_PATH"/radix_scatter.comp", { descriptorSetLayoutRadixSort }, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SortParameters));
+    countingSortCountPass = gpu::ComputePass(_core, SHADER_PATH"/counting_sort_count.comp", { descriptorSetLayoutRadixSort }, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SortParameters));
+    countingSortScatterPass = gpu::ComputePass(_core, SHADER_PATH"/counting_sort_scatter.comp", { descriptorSetLayoutRadixSort }, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SortParameters));
+    cellRangesPass = gpu::ComputePass(_core, SHADER_PATH"/start_indices.comp", descriptorSetLayoutsCell, { gpu::SpecializationConstant(1, workGroupSize) }); 
+    reorderParticlesPass = gpu::ComputePass(_core, SHADER_PATH"/reorder_particles.comp", { descriptorSetLayoutReorder }, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(ParticlePassParameters));
+    packParticlesPass = gpu::ComputePass(_core, SHADER_PATH"/pack_particles.comp", descriptorSetLayoutsParticle, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(ParticlePassParameters));
+
+    computeDensityPass = gpu::ComputePass(_core, SHADER_PATH"/compute_density.comp", descriptorSetLayoutsParticleCell, gridSpecializations);
+    computeSurfaceNormalPass = gpu::ComputePass(_core, SHADER_PATH"/compute_surface_normal.comp", descriptorSetLayoutsParticleCell, gridSpecializations);
     
-    iisphvAdvPass = gpu::ComputePass(_core, SHADER_PATH"/iisph_v_adv.comp", descriptorSetLayoutsParticleCell, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SPHSettings));
-    iisphRhoAdvPass = gpu::ComputePass(_core, SHADER_PATH"/iisph_rho_adv.comp", descriptorSetLayoutsParticleCell, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SPHSettings));
-    iisphdijpjSolvePass = gpu::ComputePass(_core, SHADER_PATH"/iisph_solve_dijpj.comp", descriptorSetLayoutsParticleCell, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SPHSettings));
-    iisphPressureSolvePass = gpu::ComputePass(_core, SHADER_PATH"/iisph_solve_pressure.comp", descriptorSetLayoutsParticleCell, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SPHSettings));
-    iisphSolveEndPass = gpu::ComputePass(_core, SHADER_PATH"/iisph_solve_end.comp", descriptorSetLayoutsParticleCell, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SPHSettings));
-
-
-    computeStressPass = gpu::ComputePass(_core, SHADER_PATH"/compute_stress.comp", descriptorSetLayoutsParticleCell, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SPHSettings));
-    computeInternalForcePass = gpu::ComputePass(_core, SHADER_PATH"/compute_internal_force.comp", descriptorSetLayoutsParticleCell, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SPHSettings));
-    integratePass = gpu::ComputePass(_core, SHADER_PATH"/integrate.comp", descriptorSetLayoutsParticle, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SPHSettings));
-    advectionPass = gpu::ComputePass(_core, SHADER_PATH"/hr_advection.comp", descriptorSetLayoutsParticleCell, { gpu::SpecializationConstant(1, workGroupSize) }, sizeof(SPHSettings));
+    iisphvAdvPass = gpu::ComputePass(_core, SHADER_PATH"/iisph_v_adv.comp", descriptorSetLayoutsParticleCell, gridSpecializations);
+    iisphRhoAdvPass = gpu::ComputePass(_core, SHADER_PATH"/iisph_rho_adv.comp", descriptorSetLayoutsParticleCell, gridSpecializations);
+    buildNeighborListPass = gpu::ComputePass(_core, SHADER_PATH"/build_neighbor_list.comp", descriptorSetLayoutsParticleCell, neighborListSpecializations);
+    iisphdijpjSolvePass = gpu::ComputePass(_core, SHADER_PATH"/iisph_solve_dijpj.comp", descriptorSetLayoutsParticleCell, neighborListSpecializations);
+    iisphPressureSolvePass = gpu::ComputePass(_core, SHADER_PATH"/iisph_solve_pressure.comp", descriptorSetLayoutsParticleCell, neighborListSpecializations);
+    iisphSolveEndPass = gpu::ComputePass(_core, SHADER_PATH"/iisph_solve_end.comp", descriptorSetLayoutsParticleCell, gridSpecializations);
+    iisphConvergencePass = gpu::ComputePass(_core, SHADER_PATH"/iisph_convergence.comp", descriptorSetLayoutsParticle, { gpu::SpecializationConstant(1, workGroupSize), gpu::SpecializationConstant(9, (uint32_t)sleepingParticles) });
+    fusedNeighborListDensityPass = gpu::ComputePass(_core, SHADER_PATH"/fused_neighbor_list_density.comp", descriptorSetLayoutsParticleCell, neighborListSpecializations);
+    fusedIISPHAdvectionPass = gpu::ComputePass(_core, SHADER_PATH"/fused_iisph_advection.comp", descriptorSetLayoutsParticleCell, gridSpecializations);
+    updateActiveParticlesPass = gpu::ComputePass(_core, SHADER_PATH"/update_active_particles.comp", descriptorSetLayoutsParticleCell, gridSpecializations);
+
+
+    std::vector<gpu::SpecializationConstant> stressSpecializations = gridSpecializations;
+    stressSpecializations.push_back(gpu::SpecializationConstant(11, glm::floatBitsToUint(stiffnessRefreshTolerance)));
+    computeStressPass = gpu::ComputePass(_core, SHADER_PATH"/compute_stress.comp", descriptorSetLayoutsParticleCell, stressSpecializations);
+    computeInternalForcePass = gpu::ComputePass(_core, SHADER_PATH"/compute_internal_force.comp", descriptorSetLayoutsParticleCell, gridSpecializations);
+    integratePass = gpu::ComputePass(_core, SHADER_PATH"/integrate.comp", descriptorSetLayoutsParticle, { gpu::SpecializationConstant(1, workGroupSize), gpu::SpecializationConstant(8, (uint32_t)fuseKernels), gpu::SpecializationConstant(9, (uint32_t)sleepingParticles), gpu::SpecializationConstant(10, sleepSteps) });
+    std::vector<gpu::SpecializationConstant> advectionSpecializations = gridSpecializations;
+    advectionSpecializations.push_back(gpu::SpecializationConstant(7, (uint32_t)hrParticleFormat));
+    advectionPass = gpu::ComputePass(_core, SHADER_PATH"/hr_advection.comp", descriptorSetLayoutsParticleCell, advectionSpecializations, sizeof(SPHSettings));
+
+    if(prerecordSubsteps){
+        recordSubstepCommandBuffers();
+    }
 
     gpu::InputManager::addKeyBinding("Toggle simulation state", [=](){
         simulationRunning = !simulationRunning;
@@ -208,35 +374,31 @@ void GranularMatter::createCommandBuffers(){
     commandBuffers.resize(gpu::MAX_FRAMES_IN_FLIGHT);
     vk::CommandBufferAllocateInfo allocInfo(_core->getCommandPool(), vk::CommandBufferLevel::ePrimary, (uint32_t) commandBuffers.size());
     commandBuffers = _core->getDevice().allocateCommandBuffers(allocInfo);
+    if(pipelinedHRAdvection){
+        hrAdvectionCommandBuffers = _core->getDevice().allocateCommandBuffers(allocInfo);
+    }
 }
 
 void GranularMatter::destroyFrameResources(){
     vk::Device device = _core->getDevice();
     device.freeCommandBuffers(_core->getCommandPool(), commandBuffers);
-
-    for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
-        _core->getDevice().destroyFence(iisphFences[i]);
-        _core->getDevice().destroySemaphore(iisphSemaphores[i]);
+    if(pipelinedHRAdvection){
+        device.freeCommandBuffers(_core->getCommandPool(), hrAdvectionCommandBuffers);
     }
+
 }
 
 void GranularMatter::initFrameResources(){
     createCommandBuffers();
-
-    iisphFences.resize(gpu::MAX_FRAMES_IN_FLIGHT);
-    iisphSemaphores.resize(gpu::MAX_FRAMES_IN_FLIGHT);
-    vk::FenceCreateInfo fenceInfo(vk::FenceCreateFlagBits::eSignaled);
-    vk::SemaphoreCreateInfo semaphoreInfo;
-    for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
-        iisphFences[i] = _core->getDevice().createFence(fenceInfo);
-        iisphSemaphores[i] = _core->getDevice().createSemaphore(semaphoreInfo);
-    }
-
 }
 
 
 void GranularMatter::update(int currentFrame, int imageIndex, float dt){ 
 
+    //* The frame fence does not cover the pipelined HR advection, its snapshot and command buffer of this frame index are reused below
+    if(pipelinedHRAdvection){
+        _core->waitAsyncTimeline(hrAdvectionTimelineValues[currentFrame]);
+    }
 
     simulationStepForward = gpu::InputManager::isKeyDown(GLFW_KEY_RIGHT);
     if(pauseOnFrame == currentFrameCount){
@@ -249,14 +411,49 @@ void GranularMatter::update(int currentFrame, int imageIndex, float dt){
         resetSimulation = false;
         simulationStepForward = false;
       
-        _core->updateBufferData(particlesBufferB, lrParticles.data(), sizeof(LRParticle) * lrParticles.size());
+        uploadLRParticles(lrParticles);
 
-        _core->updateBufferData(particlesBufferHR, hrParticles.data(), sizeof(HRParticle) * hrParticles.size());
+        uploadHRParticles(hrParticles);
+        _core->updateBufferData(particleIdsBuffer, particleIds.data(), sizeof(uint32_t) * particleIds.size());
         
     }
 
     //Read timesteps
     timestamps[currentFrame] = _core->getTimestampQueryPoolResults(&timeQueryPools[currentFrame]);
+    for (size_t row = 0; row < timestampLabels[currentFrame].size(); row++) {
+        for (size_t backend = 0; backend < SORT_BACKEND_LABELS.size(); backend++) {
+            if(timestampLabels[currentFrame][row] == SORT_BACKEND_LABELS[backend]){
+                simulationMetrics.sortTime[backend] = (timestamps[currentFrame][row + 1] - timestamps[currentFrame][row]) / 1000000.f;
+            }
+        }
+    }
+
+    //* Solver state of the substeps this frame index queued last time, they completed before its frame fence.
+    //* Reading it here instead of after every substep keeps the host from waiting for the GPU between substeps
+    if(substepHistoryCounts[currentFrame] > 0){
+        std::vector<AdditionalData> history(substepHistoryCounts[currentFrame]);
+        void* mappedData = _core->mapBuffer(substepHistoryBuffers[currentFrame]);
+        memcpy(history.data(), mappedData, sizeof(AdditionalData) * history.size());
+        _core->unmapBuffer(substepHistoryBuffers[currentFrame]);
+
+        for(const AdditionalData& substepData : history){
+            simulationMetrics.averageDensityError.append(substepData.averageDensityError);
+            simulationMetrics.maxDensityError.append(substepData.maxDensityError);
+            simulationMetrics.iterationCount.append(substepData.iterationCount);
+        }
+        additionalData = history.back();
+        simulationMetrics.activeParticleCount = sleepingParticles ? additionalData.activeParticleCount : n;
+        simulationMetrics.stiffnessRefreshCount = additionalData.stiffnessRefreshCount;
+        substepHistoryCounts[currentFrame] = 0;
+    }
+
+    //* The adaptive timestep needs the velocities of the latest substep, the only point where the host waits for the solver
+    if(adaptiveTimestep && lastSubstepTimelineValue > 0){
+        _core->waitTimeline(lastSubstepTimelineValue);
+        void* mappedData = _core->mapBuffer(additionalDataBuffer[lastSubstepFrame]);
+        memcpy(&additionalData, mappedData, sizeof(AdditionalData));
+        _core->unmapBuffer(additionalDataBuffer[lastSubstepFrame]);
+    }
 
     // Courant-Friedrichs–Lewy (CFL) condition
     float C_courant = 0.4f; 
@@ -264,6 +461,15 @@ void GranularMatter::update(int currentFrame, int imageIndex, float dt){
 
     float totalTimeStep = std::min(dt, settings.maxTimestep);//  0.004
     settings.dt = totalTimeStep; 
+
+    //* Adaptive stepping, CFL and force condition from the max velocity and acceleration of the last substep
+    if(adaptiveTimestep){
+        float C_force = 0.25f;
+        float dt_cfl = C_courant * settings.h_LR / std::max(additionalData.maxVelocity, 1e-6f);
+        float dt_force = C_force * std::sqrt(settings.h_LR / std::max(additionalData.maxAcceleration, 1e-6f));
+        float dt_adaptive = std::min(dt_cfl, dt_force);
+        substeps = std::clamp((int)std::ceil(totalTimeStep / dt_adaptive), 1, std::max(maxSubsteps, 1));
+    }
     simulationSpeedFactor = settings.dt / dt;
 
     vk::MemoryBarrier writeReadBarrier{
@@ -271,12 +477,28 @@ void GranularMatter::update(int currentFrame, int imageIndex, float dt){
         vk::AccessFlagBits::eMemoryRead
     };
 
-    _core->beginCommands(commandBuffers[currentFrame]);
+    //* Every substep is queued as its own segment on the timeline, the frame command buffer only holds the passes after them
+    vk::CommandBuffer commandBuffer = commandBuffers[currentFrame];
+    if((simulationRunning || simulationStepForward) && substeps > 0){
+        if(substepSegmentCommandBuffers[currentFrame].size() < (size_t)substeps){
+            vk::CommandBufferAllocateInfo allocInfo(_core->getCommandPool(), vk::CommandBufferLevel::ePrimary, (uint32_t)(substeps - substepSegmentCommandBuffers[currentFrame].size()));
+            std::vector<vk::CommandBuffer> segments = _core->getDevice().allocateCommandBuffers(allocInfo);
+            substepSegmentCommandBuffers[currentFrame].insert(substepSegmentCommandBuffers[currentFrame].end(), segments.begin(), segments.end());
+        }
+        if(substepHistoryCapacities[currentFrame] < (uint32_t)substeps){
+            _core->destroyBuffer(substepHistoryBuffers[currentFrame]);
+            substepHistoryBuffers[currentFrame] = _core->createBuffer(sizeof(AdditionalData) * substeps, vk::BufferUsageFlagBits::eTransferDst, vma::MemoryUsage::eAutoPreferHost, vma::AllocationCreateFlagBits::eHostAccessRandom);
+            substepHistoryCapacities[currentFrame] = (uint32_t)substeps;
+        }
+        commandBuffer = substepSegmentCommandBuffers[currentFrame][0];
+    }
+
+    _core->beginCommands(commandBuffer);
 
     // Reset query labels and pool
     timestampLabels[currentFrame] = std::vector<std::string>(); 
-    commandBuffers[currentFrame].resetQueryPool(timeQueryPools[currentFrame], 0, gpu::MAX_QUERY_POOL_COUNT);
-    commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
+    commandBuffer.resetQueryPool(timeQueryPools[currentFrame], 0, gpu::MAX_QUERY_POOL_COUNT);
+    commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
     
     //* When simulation is running or should proceed one step apply calculated forces
     if(simulationRunning || simulationStepForward){
@@ -285,34 +507,49 @@ void GranularMatter::update(int currentFrame, int imageIndex, float dt){
         subTimeStep = totalTimeStep / static_cast<float>(substeps);
         settings.dt = subTimeStep;
 
+        //* The substep passes read their parameters from uniform buffers, the pre-recorded command buffers stay valid when they change
+        {
+            void* mappedSettings = _core->mapBuffer(settingsBuffers[currentFrame]);
+            memcpy(mappedSettings, &settings, sizeof(SPHSettings));
+            _core->unmapBuffer(settingsBuffers[currentFrame]);
+
+            convergenceParams.threshold = settings.maxCompression * settings.rho0;
+            convergenceParams.criterion = convergenceCriterion;
+            void* mappedConvergenceParams = _core->mapBuffer(convergenceParamsBuffers[currentFrame]);
+            memcpy(mappedConvergenceParams, &convergenceParams, sizeof(PressureSolveConvergenceParameters));
+            _core->unmapBuffer(convergenceParamsBuffers[currentFrame]);
+        }
+
+        uint32_t fusedBarriersSaved = 0;
+        uint32_t fusedTraversalsSaved = 0;
+
         // Start Substep
         for(int i = 0; i < substeps; i++){
 
             timestampLabels[currentFrame].push_back("Init");
             {
-                commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, initPass.m_pipeline);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, initPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, initPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].pushConstants(initPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
-                commandBuffers[currentFrame].dispatch(workGroupCountLR, 1, 1);
-                commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
-                commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, initPass.m_pipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, initPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, initPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
+                commandBuffer.dispatch(workGroupCountLR, 1, 1);
+                commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+                commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
             }
             
-            timestampLabels[currentFrame].push_back("Neighborhood list sorting");
-            {   
+            timestampLabels[currentFrame].push_back(SORT_BACKEND_LABELS[static_cast<size_t>(sortBackend)]);
+            if(sortBackend == SortBackend::eBitonic){
                 //? https://poniesandlight.co.uk/reflect/bitonic_merge_sort/
                 //? https://github.com/tgfrerer/island/blob/wip/apps/examples/bitonic_merge_sort_example/bitonic_merge_sort_example_app/bitonic_merge_sort_example_app.cpp
-                commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, bitonicSortPass.m_pipeline);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, bitonicSortPass.m_pipelineLayout, 0, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, bitonicSortPass.m_pipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, bitonicSortPass.m_pipelineLayout, 0, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
 
                 auto dispatch = [ & ]( uint32_t h ) {
                     params.h = h;
 
-                    commandBuffers[currentFrame].pushConstants(bitonicSortPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(BitonicSortParameters), &params);
-                    commandBuffers[currentFrame].dispatch( workGroupCountSort, 1, 1 );
-                    commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
-                    
+                    commandBuffer.pushConstants(bitonicSortPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(BitonicSortParameters), &params);
+                    commandBuffer.dispatch( workGroupCountSort, 1, 1 );
+                    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+                
                 };
 
                 auto local_bms = [ & ]( uint32_t h ) {
@@ -336,13 +573,13 @@ void GranularMatter::update(int currentFrame, int imageIndex, float dt){
                 };
 
                 uint32_t h = workGroupSize * 2;
-                assert( h <= n );
+                assert( h <= sortElementCount );
                 assert( h % 2 == 0 );
                 assert( (h != 0) && ((h & (h - 1)) == 0) );
 
                 local_bms( h );
                 h *= 2;
-                for ( ; h <= n; h *= 2 ) {
+                for ( ; h <= sortElementCount; h *= 2 ) {
                     big_flip( h );
 
                     for ( uint32_t hh = h / 2; hh > 1; hh /= 2 ) {
@@ -355,330 +592,495 @@ void GranularMatter::update(int currentFrame, int imageIndex, float dt){
                         }
                     }
                 }
-                commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
-            }
-            
-            timestampLabels[currentFrame].push_back("Find cell startindices");
-            {
-                commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, startingIndicesPass.m_pipeline);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, startingIndicesPass.m_pipelineLayout, 0, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].dispatch(workGroupCountLR, 1, 1);
-                commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
-                commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
+                commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
             }
+            else if(sortBackend == SortBackend::eRadix){
+                //* LSD radix sort, RADIX_SORT_BITS per pass: histogram per workgroup, exclusive prefix sum, stable scatter
+                for (uint32_t pass = 0; pass < radixSortPassCount; pass++) {
+                    vk::DescriptorSet radixSortDescriptorSet = descriptorSetsRadixSort[pass % 2];
+                    sortParams.shift = pass * RADIX_SORT_BITS;
+                    sortParams.count = n;
+
+                    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, radixHistogramPass.m_pipeline);
+                    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, radixHistogramPass.m_pipelineLayout, 0, 1, &radixSortDescriptorSet, 0, nullptr);
+                    commandBuffer.pushConstants(radixHistogramPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SortParameters), &sortParams);
+                    commandBuffer.dispatch(workGroupCountKeys, 1, 1);
+                    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+
+                    prefixSumParams.count = RADIX_SORT_BUCKETS * workGroupCountKeys;
+                    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, prefixSumPass.m_pipeline);
+                    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, prefixSumPass.m_pipelineLayout, 0, 1, &descriptorSetRadixHistogramPrefixSum, 0, nullptr);
+                    commandBuffer.pushConstants(prefixSumPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PrefixSumParameters), &prefixSumParams);
+                    commandBuffer.dispatch(1, 1, 1);
+                    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+
+                    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, radixScatterPass.m_pipeline);
+                    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, radixScatterPass.m_pipelineLayout, 0, 1, &radixSortDescriptorSet, 0, nullptr);
+                    commandBuffer.pushConstants(radixScatterPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SortParameters), &sortParams);
+                    commandBuffer.dispatch(workGroupCountKeys, 1, 1);
+                    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+                }
 
-            timestampLabels[currentFrame].push_back("Compute density");
-            {
-                commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, computeDensityPass.m_pipeline);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeDensityPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeDensityPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].pushConstants(computeDensityPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
-                commandBuffers[currentFrame].dispatch(workGroupCountLR, 1, 1);
-                commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
-                commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
+                //* Odd pass count leaves the sorted entries in the temporary buffer
+                if(radixSortPassCount % 2 == 1){
+                    vk::BufferCopy copyRegion(0, 0, sizeof(ParticleGridEntry) * n);
+                    commandBuffer.copyBuffer(sortTempBuffer, particleCellBuffer, copyRegion);
+                    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+                }
+                commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
             }
-
-            timestampLabels[currentFrame].push_back("Compute surface normal");
-            {
-                commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, computeSurfaceNormalPass.m_pipeline);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeSurfaceNormalPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeSurfaceNormalPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].pushConstants(computeSurfaceNormalPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
-                commandBuffers[currentFrame].dispatch(workGroupCountLR, 1, 1);
-                commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
-                commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
+            else{
+                //* Counting sort binning: atomic count per cell key, exclusive prefix sum, scatter with the cell offsets as write cursors
+                sortParams.shift = 0;
+                sortParams.count = n;
+
+                commandBuffer.fillBuffer(cellCountsBuffer, 0, VK_WHOLE_SIZE, 0);
+                commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, countingSortCountPass.m_pipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, countingSortCountPass.m_pipelineLayout, 0, 1, &descriptorSetCountingSort, 0, nullptr);
+                commandBuffer.pushConstants(countingSortCountPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SortParameters), &sortParams);
+                commandBuffer.dispatch(workGroupCountKeys, 1, 1);
+                commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+
+                prefixSumParams.count = (uint32_t)cellRanges.size();
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, prefixSumPass.m_pipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, prefixSumPass.m_pipelineLayout, 0, 1, &descriptorSetCellCountsPrefixSum, 0, nullptr);
+                commandBuffer.pushConstants(prefixSumPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PrefixSumParameters), &prefixSumParams);
+                commandBuffer.dispatch(1, 1, 1);
+                commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, countingSortScatterPass.m_pipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, countingSortScatterPass.m_pipelineLayout, 0, 1, &descriptorSetCountingSort, 0, nullptr);
+                commandBuffer.pushConstants(countingSortScatterPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SortParameters), &sortParams);
+                commandBuffer.dispatch(workGroupCountKeys, 1, 1);
+                commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, writeReadBarrier, nullptr, nullptr);
+
+                vk::BufferCopy copyRegion(0, 0, sizeof(ParticleGridEntry) * n);
+                commandBuffer.copyBuffer(sortTempBuffer, particleCellBuffer, copyRegion);
+                commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+                commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
             }
             
-            timestampLabels[currentFrame].push_back("Compute stress");
+            //* Explicit [begin, end) per cell key from the sorted entries, neighbor loops iterate them without comparing keys
+            timestampLabels[currentFrame].push_back("Find cell ranges");
             {
-                commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, computeStressPass.m_pipeline);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeStressPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeStressPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].pushConstants(computeStressPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
-                commandBuffers[currentFrame].dispatch(workGroupCountLR, 1, 1);
-                commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
-                commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
+                commandBuffer.fillBuffer(cellRangesBuffer, 0, VK_WHOLE_SIZE, 0);
+                //* Counted by the stress pass, the barrier below covers it as well
+                uint32_t resetStiffnessRefreshCount = 0;
+                commandBuffer.updateBuffer(additionalDataBuffer[currentFrame], offsetof(AdditionalData, stiffnessRefreshCount), sizeof(uint32_t), &resetStiffnessRefreshCount);
+                commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, cellRangesPass.m_pipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cellRangesPass.m_pipelineLayout, 0, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
+                commandBuffer.dispatch(workGroupCountLR, 1, 1);
+                commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+                commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
             }
 
-            timestampLabels[currentFrame].push_back("IISPH Compute v advection");
-            {
-                commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, iisphvAdvPass.m_pipeline);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphvAdvPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphvAdvPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].pushConstants(iisphvAdvPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
-                commandBuffers[currentFrame].dispatch(workGroupCountLR, 1, 1);
-                commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
-                commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
+            //* Periodically permute the LR particles into cell order, neighbors are then contiguous in memory
+            if(i == 0 && particleReorderInterval > 0 && currentFrameCount % particleReorderInterval == 0){
+                timestampLabels[currentFrame].push_back("Reorder particles");
+                particlePassParams.count = n;
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, reorderParticlesPass.m_pipeline);
+                commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, reorderParticlesPass.m_pipelineLayout, 0, 1, &descriptorSetReorder, 0, nullptr);
+                commandBuffer.pushConstants(reorderParticlesPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(ParticlePassParameters), &particlePassParams);
+                commandBuffer.dispatch(workGroupCountKeys, 1, 1);
+                commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, writeReadBarrier, nullptr, nullptr);
+
+                for (size_t stream = 0; stream < LRParticleStream::eStreamCount; stream++) {
+                    commandBuffer.copyBuffer(particleStreamReorderBuffers[stream], particleStreamBuffers[stream], vk::BufferCopy(0, 0, LR_PARTICLE_STREAM_SIZES[stream] * n));
+                }
+                commandBuffer.copyBuffer(particleIdsReorderBuffer, particleIdsBuffer, vk::BufferCopy(0, 0, sizeof(uint32_t) * n));
+                commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+                commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
             }
 
-            timestampLabels[currentFrame].push_back("IISPH Compute rho advection");
-            {
-                commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, iisphRhoAdvPass.m_pipeline);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphRhoAdvPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphRhoAdvPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].pushConstants(iisphRhoAdvPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
-                commandBuffers[currentFrame].dispatch(workGroupCountLR, 1, 1);
-                commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
-                commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
+            //* The pass group from the neighbor lists to the integration, pre-recorded or recorded with a timestamp per pass
+            if(prerecordSubsteps){
+                timestampLabels[currentFrame].push_back("Substep solve (pre-recorded)");
+                commandBuffer.executeCommands(substepCommandBuffers[currentFrame]);
+                commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
             }
-
-            _core->endCommands(commandBuffers[currentFrame]);
-
-            //Submit Commandbuffer and wait for execution to finish
-            if (i == 0){
-                std::array<vk::CommandBuffer, 1> submitComputeCommandBuffers = { 
-                    commandBuffers[currentFrame]
-                }; 
-
-                std::vector<vk::Semaphore> signalComputeSemaphores = {iisphSemaphores[currentFrame]};
-
-                vk::SubmitInfo computeSubmitInfo{
-                    {},
-                    {},
-                    submitComputeCommandBuffers,
-                    signalComputeSemaphores
-                };
-
-                _core->getDevice().resetFences(iisphFences[currentFrame]);
-                _core->getComputeQueue().submit(computeSubmitInfo, iisphFences[currentFrame]);
-            
-                vk::Result result = _core->getDevice().waitForFences(iisphFences[currentFrame], VK_TRUE, UINT64_MAX);
-                _core->getDevice().resetFences(iisphFences[currentFrame]);
+            else{
+                recordSubstepSolve(commandBuffer, currentFrame, &timestampLabels[currentFrame]);
             }
-            else {
-                std::vector<vk::Semaphore> waitSemaphores = {
-                    iisphSemaphores[currentFrame]
-                };
-                std::vector<vk::PipelineStageFlags> waitStages = {
-                    vk::PipelineStageFlagBits::eComputeShader
-                };
-                std::vector<vk::Semaphore> signalSemaphores = {
-                    iisphSemaphores[currentFrame]
-                };
-                std::array<vk::CommandBuffer, 1> submitCommandBuffers = { 
-                    commandBuffers[currentFrame]
-                };
-                
-                vk::SubmitInfo submitInfo(waitSemaphores, waitStages, submitCommandBuffers, signalSemaphores);
-
-                _core->getDevice().resetFences(iisphFences[currentFrame]);
-
-                _core->getComputeQueue().submit(submitInfo, iisphFences[currentFrame]);
-
-                vk::Result result = _core->getDevice().waitForFences(iisphFences[currentFrame], VK_TRUE, UINT64_MAX);
+            if(fuseKernels){
+                fusedBarriersSaved += 2;
+                fusedTraversalsSaved += 3;
+            }
+    
+            //* Snapshot of the LR state the pipelined HR advection reads while the next frame solves on the live buffers
+            if(pipelinedHRAdvection && i == substeps - 1){
+                commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, writeReadBarrier, nullptr, nullptr);
+                commandBuffer.copyBuffer(particleStreamBuffers[LRParticleStream::eKinematics], snapshotKinematicsBuffers[currentFrame], vk::BufferCopy(0, 0, LR_PARTICLE_STREAM_SIZES[LRParticleStream::eKinematics] * n));
+                commandBuffer.copyBuffer(particleStreamBuffers[LRParticleStream::eDensity], snapshotDensityBuffers[currentFrame], vk::BufferCopy(0, 0, LR_PARTICLE_STREAM_SIZES[LRParticleStream::eDensity] * n));
+                commandBuffer.copyBuffer(particleCellBuffer, snapshotParticleCellBuffers[currentFrame], vk::BufferCopy(0, 0, sizeof(ParticleGridEntry) * particleCells.size()));
+                commandBuffer.copyBuffer(cellRangesBuffer, snapshotCellRangesBuffers[currentFrame], vk::BufferCopy(0, 0, sizeof(glm::uvec2) * cellRanges.size()));
             }
 
-            _core->beginCommands(commandBuffers[currentFrame]);
-
-            uint32_t l = 0;
-            float ny = settings.maxCompression * settings.rho0;
-            while ((l < 2 || std::abs(additionalData.averageDensityError) > ny) && l < 100 ) 
-            {
-                timestampLabels[currentFrame].push_back("IISPH Iteration " + std::to_string(l) + " Compute dijpj");
-                {
-                    commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, iisphdijpjSolvePass.m_pipeline);
-                    commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphdijpjSolvePass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
-                    commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphdijpjSolvePass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
-                    commandBuffers[currentFrame].pushConstants(iisphdijpjSolvePass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
-                    commandBuffers[currentFrame].dispatch(workGroupCountLR, 1, 1);
-                    commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
-                    commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
-                }
+            //* Keep the solver state of the substep, the host reads it once the frame has completed
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, writeReadBarrier, nullptr, nullptr);
+            commandBuffer.copyBuffer(additionalDataBuffer[currentFrame], substepHistoryBuffers[currentFrame], vk::BufferCopy(0, sizeof(AdditionalData) * i, sizeof(AdditionalData)));
+            vk::MemoryBarrier hostReadBarrier{
+                vk::AccessFlagBits::eMemoryWrite,
+                vk::AccessFlagBits::eHostRead
+            };
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {}, hostReadBarrier, nullptr, nullptr);
 
-                timestampLabels[currentFrame].push_back("IISPH Iteration " + std::to_string(l) + " Compute pressure");
-                {
-                    commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, iisphPressureSolvePass.m_pipeline);
-                    commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphPressureSolvePass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
-                    commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphPressureSolvePass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
-                    commandBuffers[currentFrame].pushConstants(iisphPressureSolvePass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
-                    commandBuffers[currentFrame].dispatch(workGroupCountLR, 1, 1);
-                    commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
-                    commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
-                }
+            _core->endCommands(commandBuffer);
 
-                timestampLabels[currentFrame].push_back("IISPH Iteration " + std::to_string(l) + " Write last pressure");
-                {
-                    commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, iisphSolveEndPass.m_pipeline);
-                    commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphSolveEndPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
-                    commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphSolveEndPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
-                    commandBuffers[currentFrame].pushConstants(iisphSolveEndPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
-                    commandBuffers[currentFrame].dispatch(workGroupCountLR, 1, 1);
-                    commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
-                    commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
-                }
+            //* Queue the substep without waiting for it, the next one is recorded while it runs
+            lastSubstepTimelineValue = _core->submitTimeline(_core->getComputeQueue(), commandBuffer, vk::PipelineStageFlagBits::eAllCommands);
+            lastSubstepFrame = currentFrame;
+            substepHistoryCounts[currentFrame] = (uint32_t)(i + 1);
 
-                _core->endCommands(commandBuffers[currentFrame]);
-                
-                //Submit Commandbuffer and wait for execution to finish
-                {
-                    std::vector<vk::Semaphore> waitSemaphores = {
-                        iisphSemaphores[currentFrame]
-                    };
-                    std::vector<vk::PipelineStageFlags> waitStages = {
-                        vk::PipelineStageFlagBits::eComputeShader
-                    };
-                    std::vector<vk::Semaphore> signalSemaphores = {
-                        iisphSemaphores[currentFrame]
-                    };
-                    std::array<vk::CommandBuffer, 1> submitCommandBuffers = { 
-                        commandBuffers[currentFrame]
-                    };
-                    vk::SubmitInfo submitInfo(waitSemaphores, waitStages, submitCommandBuffers, signalSemaphores);
+            commandBuffer = i + 1 < substeps ? substepSegmentCommandBuffers[currentFrame][i + 1] : commandBuffers[currentFrame];
+            _core->beginCommands(commandBuffer);
+        }
+        //End substep
+        simulationMetrics.fusedBarriersSaved = fusedBarriersSaved;
+        simulationMetrics.fusedTraversalsSaved = fusedTraversalsSaved;
 
-                    _core->getDevice().resetFences(iisphFences[currentFrame]);
-                    _core->getComputeQueue().submit(submitInfo, iisphFences[currentFrame]);
+        settings.dt = totalTimeStep; 
 
-                    vk::Result result = _core->getDevice().waitForFences(iisphFences[currentFrame], VK_TRUE, UINT64_MAX);
-                }
+        //* Keep the render attributes of the interleaved LR particle buffer up to date for the vertex input
+        timestampLabels[currentFrame].push_back("Pack LR particles");
+        {
+            particlePassParams.count = n;
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, packParticlesPass.m_pipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, packParticlesPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
+            commandBuffer.pushConstants(packParticlesPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(ParticlePassParameters), &particlePassParams);
+            commandBuffer.dispatch(workGroupCountLR, 1, 1);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eVertexInput, {}, writeReadBarrier, nullptr, nullptr);
+            commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
+        }
 
-                void* mappedData = _core->mapBuffer(additionalDataBuffer[currentFrame]);
-                // Get average density error
-                memcpy(&additionalData, mappedData, (size_t) sizeof(AdditionalData));
-                additionalData.averageDensityError /= lrParticles.size(); // average density
-                additionalData.averageDensityError -= settings.rho0; // average density error
-                
-                // Reset average density error
-                AdditionalData resetData;
-                resetData.D = additionalData.D;
-                resetData.frameIndex = currentFrameCount + 1;
-                memcpy(mappedData, &resetData, (size_t) sizeof(AdditionalData));
-                _core->flushBuffer(additionalDataBuffer[currentFrame], 0, (size_t) sizeof(AdditionalData));
-                _core->unmapBuffer(additionalDataBuffer[currentFrame]);
-                // Increase iteration count
-                l++;
-
-                _core->beginCommands(commandBuffers[currentFrame]);
-                commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eHost, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);      
-            }
-            
-            simulationMetrics.averageDensityError.append(additionalData.averageDensityError);
-            simulationMetrics.iterationCount.append(l);
+        //* Pipelined: the HR advection of this frame runs on the async compute queue from the LR snapshot and overlaps the
+        //* LR solve of the next frame. It has no timestamps, its queries would be written outside the frame's submits
+        if(pipelinedHRAdvection && substeps > 0){
+            vk::CommandBuffer hrAdvectionCommandBuffer = hrAdvectionCommandBuffers[currentFrame];
+            _core->beginCommands(hrAdvectionCommandBuffer);
+            hrAdvectionCommandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, advectionPass.m_pipeline);
+            hrAdvectionCommandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, advectionPass.m_pipelineLayout, 0, 1, &descriptorSetsHRAdvection[currentFrame], 0, nullptr);
+            hrAdvectionCommandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, advectionPass.m_pipelineLayout, 1, 1, &descriptorSetsHRAdvectionGrid[currentFrame], 0, nullptr);
+            hrAdvectionCommandBuffer.pushConstants(advectionPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
+            hrAdvectionCommandBuffer.dispatch(workGroupCountHR, 1, 1);
+            hrAdvectionCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eVertexInput, {}, writeReadBarrier, nullptr, nullptr);
+            _core->endCommands(hrAdvectionCommandBuffer);
+
+            hrAdvectionTimelineValues[currentFrame] = _core->submitAsyncTimeline(hrAdvectionCommandBuffer, lastSubstepTimelineValue, vk::PipelineStageFlagBits::eComputeShader);
+        }
+        else{
+            timestampLabels[currentFrame].push_back("Advect HR particles");
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, advectionPass.m_pipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, advectionPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, advectionPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
+            commandBuffer.pushConstants(advectionPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
+            commandBuffer.dispatch(workGroupCountHR, 1, 1);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eVertexInput, {}, writeReadBarrier, nullptr, nullptr);
+            commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
+        }
 
-            timestampLabels[currentFrame].push_back("Compute pressure force");
-            {
-                commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, computeInternalForcePass.m_pipeline);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeInternalForcePass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeInternalForcePass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].pushConstants(computeInternalForcePass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
-                commandBuffers[currentFrame].dispatch(workGroupCountLR, 1, 1);
-                commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);      
-                commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
-            }
+        simulationStepForward = false;
+        currentFrameCount++;
 
-            timestampLabels[currentFrame].push_back("Integrate");
-            {
-                commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, integratePass.m_pipeline);
-                commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, integratePass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
-                commandBuffers[currentFrame].pushConstants(integratePass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
-                commandBuffers[currentFrame].dispatch(workGroupCountLR, 1, 1);
-                commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);      
-                commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
-            }
+    }
     
-            _core->endCommands(commandBuffers[currentFrame]);
-
-            {
-                std::vector<vk::Semaphore> waitSemaphores = {
-                    iisphSemaphores[currentFrame]
-                };
-                std::vector<vk::PipelineStageFlags> waitStages = {
-                    vk::PipelineStageFlagBits::eComputeShader
-                };
-                std::vector<vk::Semaphore> signalSemaphores = {
-                    iisphSemaphores[currentFrame]
-                };
-                std::array<vk::CommandBuffer, 1> submitCommandBuffers = { 
-                    commandBuffers[currentFrame]
-                };
-                
-                vk::SubmitInfo submitInfo(waitSemaphores, waitStages, submitCommandBuffers, signalSemaphores);
+    _core->endCommands(commandBuffer);
 
-                _core->getDevice().resetFences(iisphFences[currentFrame]);
 
-                _core->getComputeQueue().submit(submitInfo, iisphFences[currentFrame]);
+}
 
-                vk::Result result = _core->getDevice().waitForFences(iisphFences[currentFrame], VK_TRUE, UINT64_MAX);
-            }
+//* Records the substep passes that follow the neighborhood grid. Without labels no timestamps are written, the
+//* pre-recorded secondary command buffers are replayed every substep and cannot know their query indices
+void GranularMatter::recordSubstepSolve(vk::CommandBuffer commandBuffer, size_t frame, std::vector<std::string>* labels){
+    vk::MemoryBarrier writeReadBarrier{
+        vk::AccessFlagBits::eMemoryWrite,
+        vk::AccessFlagBits::eMemoryRead
+    };
+    vk::PipelineStageFlags indirectComputeStages = vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eComputeShader;
 
-            _core->beginCommands(commandBuffers[currentFrame]);
+    auto beginPass = [&](const char* label){
+        if(labels){
+            labels->push_back(label);
         }
-        //End substep
+    };
+    auto endPass = [&](){
+        if(labels){
+            commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[frame], (uint32_t)labels->size());
+        }
+    };
 
-        settings.dt = totalTimeStep; 
+    //* With sleeping particles the per-particle passes only run over the awake ones
+    auto dispatchActiveParticles = [&](){
+        if(sleepingParticles){
+            commandBuffer.dispatchIndirect(activeParticlesBuffers[frame], offsetof(ActiveParticlesHeader, dispatch));
+        }
+        else{
+            commandBuffer.dispatch(workGroupCountLR, 1, 1);
+        }
+    };
 
-        timestampLabels[currentFrame].push_back("Advect HR particles");
+    //* Wake particles next to moving neighbors and compact the awake ones, the following per-particle passes are dispatched over them
+    if(sleepingParticles){
+        beginPass("Update active particles");
         {
-            commandBuffers[currentFrame].bindPipeline(vk::PipelineBindPoint::eCompute, advectionPass.m_pipeline);
-            commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, advectionPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[currentFrame], 0, nullptr);
-            commandBuffers[currentFrame].bindDescriptorSets(vk::PipelineBindPoint::eCompute, advectionPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[currentFrame], 0, nullptr);
-            commandBuffers[currentFrame].pushConstants(advectionPass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(SPHSettings), &settings);
-            commandBuffers[currentFrame].dispatch(workGroupCountHR, 1, 1);
-            commandBuffers[currentFrame].pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eVertexInput, {}, writeReadBarrier, nullptr, nullptr);
-            commandBuffers[currentFrame].writeTimestamp(vk::PipelineStageFlagBits::eComputeShader, timeQueryPools[currentFrame], (uint32_t)timestampLabels[currentFrame].size());
+            ActiveParticlesHeader activeParticlesHeader;
+            commandBuffer.updateBuffer(activeParticlesBuffers[frame], 0, sizeof(ActiveParticlesHeader), &activeParticlesHeader);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, updateActiveParticlesPass.m_pipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, updateActiveParticlesPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, updateActiveParticlesPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[frame], 0, nullptr);
+            commandBuffer.dispatch(workGroupCountLR, 1, 1);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, indirectComputeStages | vk::PipelineStageFlagBits::eTransfer, {}, writeReadBarrier, nullptr, nullptr);
+            commandBuffer.copyBuffer(activeParticlesBuffers[frame], additionalDataBuffer[frame], vk::BufferCopy(offsetof(ActiveParticlesHeader, activeCount), offsetof(AdditionalData, activeParticleCount), sizeof(uint32_t)));
+            endPass();
         }
+    }
 
-        simulationStepForward = false;
-        currentFrameCount++;
-
+    //* Positions are fixed until integration, the pressure solve iterations reuse this list
+    if(fuseKernels){
+        beginPass("Build neighbor list + density");
+        {
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, fusedNeighborListDensityPass.m_pipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, fusedNeighborListDensityPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, fusedNeighborListDensityPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[frame], 0, nullptr);
+            dispatchActiveParticles();
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+            endPass();
+        }
     }
     else{
-        _core->endCommands(commandBuffers[currentFrame]);
+        beginPass("Build neighbor list");
+        {
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, buildNeighborListPass.m_pipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, buildNeighborListPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, buildNeighborListPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[frame], 0, nullptr);
+            dispatchActiveParticles();
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+            endPass();
+        }
 
-        //Submit Commandbuffer and wait for execution to finish
+        beginPass("Compute density");
         {
-            std::array<vk::CommandBuffer, 1> submitComputeCommandBuffers = { 
-                commandBuffers[currentFrame]
-            }; 
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, computeDensityPass.m_pipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeDensityPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeDensityPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[frame], 0, nullptr);
+            dispatchActiveParticles();
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+            endPass();
+        }
+    }
 
-            std::vector<vk::Semaphore> signalComputeSemaphores = {iisphSemaphores[currentFrame]};
+    beginPass("Compute surface normal");
+    {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, computeSurfaceNormalPass.m_pipeline);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeSurfaceNormalPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeSurfaceNormalPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[frame], 0, nullptr);
+        dispatchActiveParticles();
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+        endPass();
+    }
+    
+    beginPass("Compute stress");
+    {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, computeStressPass.m_pipeline);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeStressPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeStressPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[frame], 0, nullptr);
+        dispatchActiveParticles();
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+        endPass();
+    }
 
-            vk::SubmitInfo computeSubmitInfo{
-                {},
-                {},
-                submitComputeCommandBuffers,
-                signalComputeSemaphores
-            };
+    //* The v advection writes the velocities the rho advection reads from the neighbors, the fused kernel
+    //* forms them in registers instead and leaves the velocity update to the integration
+    if(fuseKernels){
+        beginPass("IISPH Compute v + rho advection");
+        {
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, fusedIISPHAdvectionPass.m_pipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, fusedIISPHAdvectionPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, fusedIISPHAdvectionPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[frame], 0, nullptr);
+            dispatchActiveParticles();
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+            endPass();
+        }
+    }
+    else{
+        beginPass("IISPH Compute v advection");
+        {
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, iisphvAdvPass.m_pipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphvAdvPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphvAdvPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[frame], 0, nullptr);
+            dispatchActiveParticles();
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+            endPass();
+        }
 
-            _core->getDevice().resetFences(iisphFences[currentFrame]);
-            _core->getComputeQueue().submit(computeSubmitInfo, iisphFences[currentFrame]);
-        
-            vk::Result result = _core->getDevice().waitForFences(iisphFences[currentFrame], VK_TRUE, UINT64_MAX);
-            _core->getDevice().resetFences(iisphFences[currentFrame]);
+        beginPass("IISPH Compute rho advection");
+        {
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, iisphRhoAdvPass.m_pipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphRhoAdvPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphRhoAdvPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[frame], 0, nullptr);
+            dispatchActiveParticles();
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);
+            endPass();
+        }
+    }
+
+    //* Reset the pressure solve dispatch arguments and the iteration count on the device, with sleeping particles the solve runs over the active list
+    {
+        if(sleepingParticles){
+            commandBuffer.copyBuffer(activeParticlesBuffers[frame], pressureSolveDispatchBuffers[frame], vk::BufferCopy(offsetof(ActiveParticlesHeader, dispatch), 0, sizeof(vk::DispatchIndirectCommand)));
+        }
+        else{
+            vk::DispatchIndirectCommand pressureSolveDispatch(workGroupCountLR, 1, 1);
+            commandBuffer.updateBuffer(pressureSolveDispatchBuffers[frame], 0, sizeof(vk::DispatchIndirectCommand), &pressureSolveDispatch);
         }
 
-        _core->beginCommands(commandBuffers[currentFrame]);
+        uint32_t resetIterationCount = 0;
+        commandBuffer.updateBuffer(additionalDataBuffer[frame], offsetof(AdditionalData, iterationCount), sizeof(uint32_t), &resetIterationCount);
+        std::array<float, 2> resetMaxVelocityAcceleration = { 0.f, 0.f };
+        commandBuffer.updateBuffer(additionalDataBuffer[frame], offsetof(AdditionalData, maxVelocity), sizeof(float) * resetMaxVelocityAcceleration.size(), resetMaxVelocityAcceleration.data());
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, indirectComputeStages, {}, writeReadBarrier, nullptr, nullptr);
+    }
 
+    //* The convergence pass sets the dispatch size to zero once the solver converged, remaining iterations become empty dispatches
+    beginPass("IISPH Pressure solve");
+    {
+        for (uint32_t l = 0; l < maxPressureIterations; l++){
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, iisphdijpjSolvePass.m_pipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphdijpjSolvePass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphdijpjSolvePass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[frame], 0, nullptr);
+            commandBuffer.dispatchIndirect(pressureSolveDispatchBuffers[frame], 0);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, indirectComputeStages, {}, writeReadBarrier, nullptr, nullptr);
+
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, iisphPressureSolvePass.m_pipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphPressureSolvePass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphPressureSolvePass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[frame], 0, nullptr);
+            commandBuffer.dispatchIndirect(pressureSolveDispatchBuffers[frame], 0);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, indirectComputeStages, {}, writeReadBarrier, nullptr, nullptr);
+
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, iisphSolveEndPass.m_pipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphSolveEndPass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphSolveEndPass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[frame], 0, nullptr);
+            commandBuffer.dispatchIndirect(pressureSolveDispatchBuffers[frame], 0);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, indirectComputeStages, {}, writeReadBarrier, nullptr, nullptr);
+
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, iisphConvergencePass.m_pipeline);
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, iisphConvergencePass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+            commandBuffer.dispatch(1, 1, 1);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, indirectComputeStages, {}, writeReadBarrier, nullptr, nullptr);
+        }
+        endPass();
     }
-    
-    _core->endCommands(commandBuffers[currentFrame]);
 
+    beginPass("Compute pressure force");
+    {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, computeInternalForcePass.m_pipeline);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeInternalForcePass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeInternalForcePass.m_pipelineLayout, 1, 1, &descriptorSetsGrid[frame], 0, nullptr);
+        dispatchActiveParticles();
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);      
+        endPass();
+    }
 
+    beginPass("Integrate");
+    {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, integratePass.m_pipeline);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, integratePass.m_pipelineLayout, 0, 1, &descriptorSetsParticles[frame], 0, nullptr);
+        dispatchActiveParticles();
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, writeReadBarrier, nullptr, nullptr);      
+        endPass();
+    }
 }
 
+void GranularMatter::recordSubstepCommandBuffers(){
+    substepCommandBuffers = _core->getDevice().allocateCommandBuffers(vk::CommandBufferAllocateInfo(_core->getCommandPool(), vk::CommandBufferLevel::eSecondary, gpu::MAX_FRAMES_IN_FLIGHT));
+    for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
+        vk::CommandBufferInheritanceInfo inheritanceInfo;
+        //* Replayed by every substep segment of the frame, several of them are pending at once
+        _core->beginCommands(substepCommandBuffers[i], vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eSimultaneousUse, &inheritanceInfo));
+        recordSubstepSolve(substepCommandBuffers[i], i, nullptr);
+        _core->endCommands(substepCommandBuffers[i]);
+    }
+}
 
 void GranularMatter::createDescriptorPool() {
 
+    //* The pipelined HR advection has a second particle and grid set per frame that reads the LR snapshot
+    uint32_t frameSetCopies = pipelinedHRAdvection ? 2 : 1;
     descriptorPool = _core->createDescriptorPool({
-        { vk::DescriptorType::eStorageBuffer, (2 + 1 + 1 + 1 + 1 + 1) * gpu::MAX_FRAMES_IN_FLIGHT },
-        { vk::DescriptorType::eSampler, 1 * gpu::MAX_FRAMES_IN_FLIGHT },
-        { vk::DescriptorType::eSampledImage, (uint32_t)signedDistanceFieldViews.size() * gpu::MAX_FRAMES_IN_FLIGHT },
-    }, (1 + 1 + 1) * gpu::MAX_FRAMES_IN_FLIGHT);
+        { vk::DescriptorType::eStorageBuffer, (2 + 3 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 6 + 1 + 1) * gpu::MAX_FRAMES_IN_FLIGHT * frameSetCopies + 3 * 2 + 1 + 3 + 1 + 15 },
+        { vk::DescriptorType::eUniformBuffer, 2 * gpu::MAX_FRAMES_IN_FLIGHT * frameSetCopies },
+        { vk::DescriptorType::eSampler, 1 * gpu::MAX_FRAMES_IN_FLIGHT * frameSetCopies },
+        { vk::DescriptorType::eSampledImage, (uint32_t)signedDistanceFieldViews.size() * gpu::MAX_FRAMES_IN_FLIGHT * frameSetCopies },
+    }, (1 + 1 + 1) * gpu::MAX_FRAMES_IN_FLIGHT + 2 * (frameSetCopies - 1) * gpu::MAX_FRAMES_IN_FLIGHT + 2 + 1 + 2 + 1);
 }
 
 void GranularMatter::createDescriptorSetLayout() {
     
     descriptorSetLayoutGrid = _core->createDescriptorSetLayout({
         {0, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {2, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {3, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {4, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute}
+    });
+
+    descriptorSetLayoutRadixSort = _core->createDescriptorSetLayout({
+        {0, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
         {2, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute}
     });
 
+    descriptorSetLayoutPrefixSum = _core->createDescriptorSetLayout({
+        {0, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute}
+    });
+
+    //* 0: grid lookup, 1-6: particle streams, 7-12: reordered particle streams, 13-14: particle ids
+    descriptorSetLayoutReorder = _core->createDescriptorSetLayout({
+        {0, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {2, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {3, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {4, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {5, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {6, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {7, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {8, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {9, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {10, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {11, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {12, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {13, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {14, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute}
+    });
+
     descriptorSetLayoutParticles = _core->createDescriptorSetLayout({
+        {0, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
         {1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
         {2, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
         {3, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
         {4, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
         {5, vk::DescriptorType::eSampler, vk::ShaderStageFlagBits::eCompute},
-        {6, vk::DescriptorType::eSampledImage, (uint32_t)signedDistanceFieldViews.size(), vk::ShaderStageFlagBits::eCompute, vk::DescriptorBindingFlagBits::eVariableDescriptorCount | vk::DescriptorBindingFlagBits::ePartiallyBound }
+        //* SPHSettings of the substep passes
+        {6, vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eCompute},
+        {7, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        //* LR particle streams, see LRParticleStream
+        {8, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {9, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {10, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {11, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {12, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {13, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        //* Active particle list
+        {14, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        //* PressureSolveConvergenceParameters
+        {15, vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eCompute},
+        //* Brick tables of the sparse volume maps
+        {16, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        //* Variable count array has to be the highest binding
+        {17, vk::DescriptorType::eSampledImage, (uint32_t)signedDistanceFieldViews.size(), vk::ShaderStageFlagBits::eCompute, vk::DescriptorBindingFlagBits::eVariableDescriptorCount | vk::DescriptorBindingFlagBits::ePartiallyBound }
     });
 
 }
@@ -686,19 +1088,83 @@ void GranularMatter::createDescriptorSetLayout() {
 void GranularMatter::createDescriptorSets() {
     descriptorSetsGrid = _core->allocateDescriptorSets(descriptorSetLayoutGrid, descriptorPool, gpu::MAX_FRAMES_IN_FLIGHT);
     descriptorSetsParticles = _core->allocateDescriptorSets(descriptorSetLayoutParticles, descriptorPool, gpu::MAX_FRAMES_IN_FLIGHT);
+
+    //* Radix sort ping-pongs between the particle cell buffer and the temporary buffer, the sort buffers are shared by all frames
+    descriptorSetsRadixSort = _core->allocateDescriptorSets(descriptorSetLayoutRadixSort, descriptorPool, 2);
+    std::array<vk::Buffer, 2> radixSortBuffers = { particleCellBuffer, sortTempBuffer };
+    for (size_t i = 0; i < 2; i++) {
+        _core->addDescriptorWrite(descriptorSetsRadixSort[i], { 0, vk::DescriptorType::eStorageBuffer, radixSortBuffers[i], sizeof(ParticleGridEntry) * particleCells.size() });
+        _core->addDescriptorWrite(descriptorSetsRadixSort[i], { 1, vk::DescriptorType::eStorageBuffer, radixSortBuffers[(i + 1) % 2], sizeof(ParticleGridEntry) * particleCells.size() });
+        _core->addDescriptorWrite(descriptorSetsRadixSort[i], { 2, vk::DescriptorType::eStorageBuffer, radixHistogramBuffer, sizeof(uint32_t) * RADIX_SORT_BUCKETS * workGroupCountKeys });
+        _core->updateDescriptorSet(descriptorSetsRadixSort[i]);
+    }
+
+    descriptorSetRadixHistogramPrefixSum = _core->allocateDescriptorSets(descriptorSetLayoutPrefixSum, descriptorPool, 1)[0];
+    _core->addDescriptorWrite(descriptorSetRadixHistogramPrefixSum, { 0, vk::DescriptorType::eStorageBuffer, radixHistogramBuffer, sizeof(uint32_t) * RADIX_SORT_BUCKETS * workGroupCountKeys });
+    _core->updateDescriptorSet(descriptorSetRadixHistogramPrefixSum);
+
+    //* Counting sort bins from the particle cell buffer into the temporary buffer, the cell counts become the cell offsets
+    descriptorSetCountingSort = _core->allocateDescriptorSets(descriptorSetLayoutRadixSort, descriptorPool, 1)[0];
+    _core->addDescriptorWrite(descriptorSetCountingSort, { 0, vk::DescriptorType::eStorageBuffer, particleCellBuffer, sizeof(ParticleGridEntry) * particleCells.size() });
+    _core->addDescriptorWrite(descriptorSetCountingSort, { 1, vk::DescriptorType::eStorageBuffer, sortTempBuffer, sizeof(ParticleGridEntry) * particleCells.size() });
+    _core->addDescriptorWrite(descriptorSetCountingSort, { 2, vk::DescriptorType::eStorageBuffer, cellCountsBuffer, sizeof(uint32_t) * cellRanges.size() });
+    _core->updateDescriptorSet(descriptorSetCountingSort);
+
+    descriptorSetCellCountsPrefixSum = _core->allocateDescriptorSets(descriptorSetLayoutPrefixSum, descriptorPool, 1)[0];
+    _core->addDescriptorWrite(descriptorSetCellCountsPrefixSum, { 0, vk::DescriptorType::eStorageBuffer, cellCountsBuffer, sizeof(uint32_t) * cellRanges.size() });
+    _core->updateDescriptorSet(descriptorSetCellCountsPrefixSum);
+
+    //* Reorder gathers into the temporary particle buffers, they are copied back afterwards
+    descriptorSetReorder = _core->allocateDescriptorSets(descriptorSetLayoutReorder, descriptorPool, 1)[0];
+    _core->addDescriptorWrite(descriptorSetReorder, { 0, vk::DescriptorType::eStorageBuffer, particleCellBuffer, sizeof(ParticleGridEntry) * particleCells.size() });
+    for (uint32_t stream = 0; stream < LRParticleStream::eStreamCount; stream++) {
+        _core->addDescriptorWrite(descriptorSetReorder, { 1 + stream, vk::DescriptorType::eStorageBuffer, particleStreamBuffers[stream], LR_PARTICLE_STREAM_SIZES[stream] * n });
+        _core->addDescriptorWrite(descriptorSetReorder, { 1 + LRParticleStream::eStreamCount + stream, vk::DescriptorType::eStorageBuffer, particleStreamReorderBuffers[stream], LR_PARTICLE_STREAM_SIZES[stream] * n });
+    }
+    _core->addDescriptorWrite(descriptorSetReorder, { 1 + 2 * LRParticleStream::eStreamCount, vk::DescriptorType::eStorageBuffer, particleIdsBuffer, sizeof(uint32_t) * particleIds.size() });
+    _core->addDescriptorWrite(descriptorSetReorder, { 2 + 2 * LRParticleStream::eStreamCount, vk::DescriptorType::eStorageBuffer, particleIdsReorderBuffer, sizeof(uint32_t) * particleIds.size() });
+    _core->updateDescriptorSet(descriptorSetReorder);
     
-    for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
-        _core->addDescriptorWrite(descriptorSetsGrid[i], { 0, vk::DescriptorType::eStorageBuffer, particleCellBuffer, sizeof(ParticleGridEntry) * particleCells.size() });
-        _core->addDescriptorWrite(descriptorSetsGrid[i], { 2, vk::DescriptorType::eStorageBuffer, startingIndicesBuffers, sizeof(uint32_t) * startingIndices.size() });
-        _core->updateDescriptorSet(descriptorSetsGrid[i]);
+    //* The per-frame sets, the HR advection sets of the pipelined mode read the streams and the grid from the LR snapshot
+    auto writeFrameDescriptorSets = [&](size_t i, vk::DescriptorSet gridSet, vk::DescriptorSet particleSet, std::array<vk::Buffer, LRParticleStream::eStreamCount> streamBuffers, vk::Buffer gridLookupBuffer, vk::Buffer rangesBuffer){
+        _core->addDescriptorWrite(gridSet, { 0, vk::DescriptorType::eStorageBuffer, gridLookupBuffer, sizeof(ParticleGridEntry) * particleCells.size() });
+        _core->addDescriptorWrite(gridSet, { 1, vk::DescriptorType::eStorageBuffer, neighborCountsBuffer, sizeof(uint32_t) * n });
+        _core->addDescriptorWrite(gridSet, { 2, vk::DescriptorType::eStorageBuffer, rangesBuffer, sizeof(glm::uvec2) * cellRanges.size() });
+        _core->addDescriptorWrite(gridSet, { 3, vk::DescriptorType::eStorageBuffer, neighborsBuffer, sizeof(uint32_t) * n * maxNeighbors });
+        _core->addDescriptorWrite(gridSet, { 4, vk::DescriptorType::eStorageBuffer, neighborGradWBuffer, sizeof(glm::vec4) * n * maxNeighbors });
+        _core->updateDescriptorSet(gridSet);
         
-        _core->addDescriptorWrite(descriptorSetsParticles[i], { 1, vk::DescriptorType::eStorageBuffer, particlesBufferB, sizeof(LRParticle) * lrParticles.size() });
-        _core->addDescriptorWrite(descriptorSetsParticles[i], { 2, vk::DescriptorType::eStorageBuffer, particlesBufferHR, sizeof(HRParticle) * hrParticles.size() });
-        _core->addDescriptorWrite(descriptorSetsParticles[i], { 3, vk::DescriptorType::eStorageBuffer, additionalDataBuffer[i], sizeof(AdditionalData) });
-        _core->addDescriptorWrite(descriptorSetsParticles[i], { 4, vk::DescriptorType::eStorageBuffer, volumeMapTransformsBuffer, volumeMapTransforms.size() * sizeof(VolumeMapTransform)});
-        _core->addDescriptorWrite(descriptorSetsParticles[i], { 5, vk::DescriptorType::eSampler, volumeMapSampler, {}, {} });
-        _core->addDescriptorWrite(descriptorSetsParticles[i], { 6, vk::DescriptorType::eSampledImage, {}, signedDistanceFieldViews, vk::ImageLayout::eShaderReadOnlyOptimal });
-        _core->updateDescriptorSet(descriptorSetsParticles[i]);
+        _core->addDescriptorWrite(particleSet, { 0, vk::DescriptorType::eStorageBuffer, pressureSolveDispatchBuffers[i], sizeof(vk::DispatchIndirectCommand) });
+        _core->addDescriptorWrite(particleSet, { 1, vk::DescriptorType::eStorageBuffer, particlesBufferB, sizeof(LRParticle) * lrParticles.size() });
+        for (uint32_t stream = 0; stream < LRParticleStream::eStreamCount; stream++) {
+            _core->addDescriptorWrite(particleSet, { LR_PARTICLE_STREAM_BINDING + stream, vk::DescriptorType::eStorageBuffer, streamBuffers[stream], LR_PARTICLE_STREAM_SIZES[stream] * n });
+        }
+        _core->addDescriptorWrite(particleSet, { 2, vk::DescriptorType::eStorageBuffer, particlesBufferHR, hrParticleSize() * hrParticles.size() });
+        _core->addDescriptorWrite(particleSet, { 3, vk::DescriptorType::eStorageBuffer, additionalDataBuffer[i], sizeof(AdditionalData) });
+        _core->addDescriptorWrite(particleSet, { 4, vk::DescriptorType::eStorageBuffer, volumeMapTransformsBuffer, volumeMapTransforms.size() * sizeof(VolumeMapTransform)});
+        _core->addDescriptorWrite(particleSet, { 5, vk::DescriptorType::eSampler, volumeMapSampler, {}, {} });
+        _core->addDescriptorWrite(particleSet, { 6, vk::DescriptorType::eUniformBuffer, settingsBuffers[i], sizeof(SPHSettings) });
+        _core->addDescriptorWrite(particleSet, { 7, vk::DescriptorType::eStorageBuffer, densityErrorPartialsBuffers[i], sizeof(glm::vec2) * workGroupCountLR });
+        _core->addDescriptorWrite(particleSet, { 15, vk::DescriptorType::eUniformBuffer, convergenceParamsBuffers[i], sizeof(PressureSolveConvergenceParameters) });
+        _core->addDescriptorWrite(particleSet, { 14, vk::DescriptorType::eStorageBuffer, activeParticlesBuffers[i], sizeof(ActiveParticlesHeader) + sizeof(uint32_t) * n });
+        _core->addDescriptorWrite(particleSet, { 16, vk::DescriptorType::eStorageBuffer, volumeMapBrickTableBuffer, volumeMapBrickTable.size() * sizeof(uint32_t) });
+        _core->addDescriptorWrite(particleSet, { 17, vk::DescriptorType::eSampledImage, {}, signedDistanceFieldViews, vk::ImageLayout::eShaderReadOnlyOptimal });
+        _core->updateDescriptorSet(particleSet);
+    };
+
+    for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
+        writeFrameDescriptorSets(i, descriptorSetsGrid[i], descriptorSetsParticles[i], particleStreamBuffers, particleCellBuffer, cellRangesBuffer);
+    }
+
+    if(pipelinedHRAdvection){
+        descriptorSetsHRAdvectionGrid = _core->allocateDescriptorSets(descriptorSetLayoutGrid, descriptorPool, gpu::MAX_FRAMES_IN_FLIGHT);
+        descriptorSetsHRAdvection = _core->allocateDescriptorSets(descriptorSetLayoutParticles, descriptorPool, gpu::MAX_FRAMES_IN_FLIGHT);
+        for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
+            std::array<vk::Buffer, LRParticleStream::eStreamCount> snapshotStreamBuffers = particleStreamBuffers;
+            snapshotStreamBuffers[LRParticleStream::eKinematics] = snapshotKinematicsBuffers[i];
+            snapshotStreamBuffers[LRParticleStream::eDensity] = snapshotDensityBuffers[i];
+            writeFrameDescriptorSets(i, descriptorSetsHRAdvectionGrid[i], descriptorSetsHRAdvection[i], snapshotStreamBuffers, snapshotParticleCellBuffers[i], snapshotCellRangesBuffers[i]);
+        }
     }
 }
 
@@ -711,6 +1177,92 @@ void GranularMatter::updateVolumeMapTransforms()
     }
 }
 
+void GranularMatter::uploadLRParticles(std::vector<LRParticle>& particles)
+{
+    _core->updateBufferData(particlesBufferB, particles.data(), sizeof(LRParticle) * particles.size());
+
+    std::vector<LRParticleKinematics> kinematics(particles.size());
+    std::vector<LRParticleDensity> density(particles.size());
+    std::vector<LRParticleSolver> solver(particles.size());
+    std::vector<LRParticleStress> stress(particles.size());
+    std::vector<LRParticleForces> forces(particles.size());
+    //* Built again by the first stress pass, also after a reset or a scene change
+    std::vector<LRParticleStiffness> stiffness(particles.size());
+    for (size_t i = 0; i < particles.size(); i++) {
+        const LRParticle& p = particles[i];
+        kinematics[i].position = glm::vec3(p.position);
+        kinematics[i].velocity = glm::vec3(p.velocity);
+        density[i] = { p.rho, p.p, p.lastP, p.V };
+        solver[i] = { p.d, p.dijpj, p.a, p.dpi, p.densityAdv, 0.f };
+        stress[i] = { p.stress, p.deviatoricStress };
+        forces[i] = { p.externalForce, p.internalForce, p.averageN, p.color };
+    }
+    _core->updateBufferData(particleStreamBuffers[LRParticleStream::eKinematics], kinematics.data(), sizeof(LRParticleKinematics) * kinematics.size());
+    _core->updateBufferData(particleStreamBuffers[LRParticleStream::eDensity], density.data(), sizeof(LRParticleDensity) * density.size());
+    _core->updateBufferData(particleStreamBuffers[LRParticleStream::eSolver], solver.data(), sizeof(LRParticleSolver) * solver.size());
+    _core->updateBufferData(particleStreamBuffers[LRParticleStream::eStress], stress.data(), sizeof(LRParticleStress) * stress.size());
+    _core->updateBufferData(particleStreamBuffers[LRParticleStream::eForces], forces.data(), sizeof(LRParticleForces) * forces.size());
+    _core->updateBufferData(particleStreamBuffers[LRParticleStream::eStiffness], stiffness.data(), sizeof(LRParticleStiffness) * stiffness.size());
+}
+
+size_t GranularMatter::hrParticleSize()
+{
+    return hrParticleFormat == HRParticleFormat::eCompact ? sizeof(CompactHRParticle) : sizeof(HRParticle);
+}
+
+void GranularMatter::uploadHRParticles(std::vector<HRParticle>& particles)
+{
+    if(hrParticleFormat != HRParticleFormat::eCompact){
+        _core->updateBufferData(particlesBufferHR, particles.data(), sizeof(HRParticle) * particles.size());
+        return;
+    }
+
+    std::vector<CompactHRParticle> compactParticles(particles.size());
+    for (size_t i = 0; i < particles.size(); i++) {
+        uint32_t paletteIndex = (uint32_t)(std::find(colorPalette.begin(), colorPalette.end(), particles[i].color) - colorPalette.begin());
+        compactParticles[i] = CompactHRParticle(particles[i], std::min(paletteIndex, (uint32_t)colorPalette.size() - 1), settings.h_LR);
+    }
+    _core->updateBufferData(particlesBufferHR, compactParticles.data(), sizeof(CompactHRParticle) * compactParticles.size());
+}
+
+void GranularMatter::loadScene(int scene)
+{
+    switch (scene)
+    {
+    case 0: // Dump truck scene
+        uploadLRParticles(lrParticles2);
+        uploadHRParticles(hrParticles2);
+        _core->updateBufferData(particleIdsBuffer, particleIds.data(), particleIds.size() * sizeof(uint32_t));
+
+        volumeMapTransforms[0].enable(); // enable dump_truck
+        volumeMapTransforms[1].enable(); // enable plane
+        volumeMapTransforms[2].disable(); // disable hourglas
+        break;
+    case 1: // Plane only
+        uploadLRParticles(lrParticles);
+        uploadHRParticles(hrParticles);
+        _core->updateBufferData(particleIdsBuffer, particleIds.data(), particleIds.size() * sizeof(uint32_t));
+
+        volumeMapTransforms[0].disable(); // disable dump_truck
+        volumeMapTransforms[1].enable(); // enable plane
+        volumeMapTransforms[2].disable(); // disable hourglas
+        break;
+    case 2: // hourglas scene
+        uploadLRParticles(lrParticles2);
+        uploadHRParticles(hrParticles2);
+        _core->updateBufferData(particleIdsBuffer, particleIds.data(), particleIds.size() * sizeof(uint32_t));
+
+        volumeMapTransforms[0].disable(); // disable dump_truck
+        volumeMapTransforms[1].disable(); // disable plane
+        volumeMapTransforms[2].enable(); // hourglas hourglas
+        break;
+    
+    default:
+        break;
+    }
+    updateVolumeMapTransforms();
+}
+
 #define EPSILON 0.0000001f
 
 float cubicSplineKernel(float r, float h){
@@ -739,10 +1291,139 @@ float cubicExtension(float r){
 }
 
 
+std::vector<glm::vec4> GranularMatter::bakeVolumeMap(RigidBody2D* rb, AABB aabb, glm::uvec3 size)
+{
+    //* Get Sampling Step Size
+    glm::vec3 stepSize = aabb.size() / glm::vec3(size);
+    int width = (int)size.x;
+    int height = (int)size.y;
+    int depth = (int)size.z;
+    std::vector<glm::vec4> volumeMap(width * height * depth);
+
+    //* Every worker takes the next unbaked z-slab until none are left, slabs near the mesh cost more than empty ones
+    std::atomic<int> nextSlab = 0;
+    auto bakeSlabs = [&](){
+        for(int z = nextSlab++; z < depth; z = nextSlab++){
+            for(int y = 0; y < height; y++){
+                for(int x = 0; x < width; x++){
+                    glm::vec3 samplePoint = glm::vec3{
+                        aabb.min.x + x * stepSize.x + (0.5 * stepSize.x), 
+                        aabb.min.y + y * stepSize.y + (0.5 * stepSize.y), 
+                        aabb.min.z + z * stepSize.z + (0.5 * stepSize.z)  
+                    };
+
+                    SignedDistanceSample sample = rb->signedDistanceSample(samplePoint);
+                    float sd = sample.distance + settings.r_LR * 1.f;
+                    float volume = cubicExtension(sd);
+
+                    glm::vec3 nearestPoint = sample.gradient + glm::normalize(sample.gradient) * settings.r_LR * 1.f;
+                    volumeMap[(z * height + y) * width + x] = glm::vec4(nearestPoint.x, nearestPoint.y, nearestPoint.z, volume);
+                }
+            }
+        }
+    };
+
+    uint32_t threadCount = std::clamp(std::thread::hardware_concurrency(), 1u, (uint32_t)depth);
+    std::vector<std::thread> workers;
+    for(uint32_t i = 1; i < threadCount; i++){
+        workers.emplace_back(bakeSlabs);
+    }
+    bakeSlabs();
+    for(auto& worker : workers){
+        worker.join();
+    }
+    return volumeMap;
+}
+
+vk::Image GranularMatter::bakeVolumeMapGPU(const Mesh3D& mesh, AABB aabb, glm::uvec3 size, std::vector<glm::vec4>* volumeMap)
+{
+    VolumeMapBakeGeometry geometry = buildVolumeMapBakeGeometry(mesh);
+    size_t sampleCount = (size_t)size.x * size.y * size.z;
+
+    vk::Buffer trianglesBuffer = _core->bufferFromData(geometry.triangles.data(), geometry.triangles.size() * sizeof(VolumeMapBakeTriangle), vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferDevice);
+    vk::Buffer clustersBuffer = _core->bufferFromData(geometry.clusters.data(), geometry.clusters.size() * sizeof(VolumeMapBakeBounds), vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferDevice);
+    vk::Buffer groupsBuffer = _core->bufferFromData(geometry.groups.data(), geometry.groups.size() * sizeof(VolumeMapBakeBounds), vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferDevice);
+    vk::Buffer samplesBuffer = _core->createBuffer(sampleCount * sizeof(glm::vec4), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc, vma::MemoryUsage::eAutoPreferDevice);
+
+    vk::DescriptorSetLayout bakeLayout = _core->createDescriptorSetLayout({
+        {0, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {2, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute},
+        {3, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute}
+    });
+    vk::DescriptorPool bakePool = _core->createDescriptorPool({
+        { vk::DescriptorType::eStorageBuffer, 4 },
+    }, 1);
+    vk::DescriptorSet bakeSet = _core->allocateDescriptorSets(bakeLayout, bakePool, 1)[0];
+    _core->addDescriptorWrite(bakeSet, { 0, vk::DescriptorType::eStorageBuffer, trianglesBuffer, geometry.triangles.size() * sizeof(VolumeMapBakeTriangle) });
+    _core->addDescriptorWrite(bakeSet, { 1, vk::DescriptorType::eStorageBuffer, clustersBuffer, geometry.clusters.size() * sizeof(VolumeMapBakeBounds) });
+    _core->addDescriptorWrite(bakeSet, { 2, vk::DescriptorType::eStorageBuffer, groupsBuffer, geometry.groups.size() * sizeof(VolumeMapBakeBounds) });
+    _core->addDescriptorWrite(bakeSet, { 3, vk::DescriptorType::eStorageBuffer, samplesBuffer, sampleCount * sizeof(glm::vec4) });
+    _core->updateDescriptorSet(bakeSet);
+
+    gpu::ComputePass bakePass = gpu::ComputePass(_core, SHADER_PATH"/bake_volume_map.comp", { bakeLayout }, sizeof(VolumeMapBakeParameters));
+
+    VolumeMapBakeParameters parameters;
+    parameters.aabbMin = glm::vec4(aabb.min, 0.f);
+    parameters.stepSize = glm::vec4(aabb.size() / glm::vec3(size), 0.f);
+    parameters.size = glm::uvec4(size, 0);
+    parameters.triangleCount = (uint32_t)geometry.triangles.size();
+    parameters.clusterCount = (uint32_t)geometry.clusters.size();
+    parameters.groupCount = (uint32_t)geometry.groups.size();
+    parameters.r_LR = settings.r_LR;
+    parameters.h_LR = settings.h_LR;
+
+    //* One submission per few z-slabs, a single dispatch over a large map can run into device timeouts
+    for(uint32_t z = 0; z < size.z; z += VOLUME_MAP_BAKE_SLABS_PER_SUBMIT){
+        parameters.size.w = z;
+        uint32_t slabs = std::min(VOLUME_MAP_BAKE_SLABS_PER_SUBMIT, size.z - z);
+
+        vk::CommandBuffer commandBuffer = _core->beginSingleTimeCommands();
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, bakePass.m_pipeline);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, bakePass.m_pipelineLayout, 0, 1, &bakeSet, 0, nullptr);
+        commandBuffer.pushConstants(bakePass.m_pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(VolumeMapBakeParameters), &parameters);
+        commandBuffer.dispatch((size.x + 3) / 4, (size.y + 3) / 4, (slabs + 3) / 4);
+
+        vk::MemoryBarrier writeTransferBarrier{
+            vk::AccessFlagBits::eShaderWrite,
+            vk::AccessFlagBits::eTransferRead
+        };
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, writeTransferBarrier, nullptr, nullptr);
+        _core->endSingleTimeCommands(commandBuffer);
+    }
+
+    vk::Image image;
+    if(volumeMap == nullptr){
+        image = _core->createImage3D(vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, vma::MemoryUsage::eAutoPreferDevice, {}, size.x, size.y, size.z, vk::Format::eR32G32B32A32Sfloat);
+        _core->transitionImageLayout(image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer);
+        _core->copyBufferToImage(samplesBuffer, image, size.x, size.y, size.z);
+        _core->transitionImageLayout(image, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader);
+    }
+    else{
+        vk::Buffer readbackBuffer = _core->createBuffer(sampleCount * sizeof(glm::vec4), vk::BufferUsageFlagBits::eTransferDst, vma::MemoryUsage::eAutoPreferHost, vma::AllocationCreateFlagBits::eHostAccessRandom);
+        _core->copyBufferToBuffer(samplesBuffer, readbackBuffer, sampleCount * sizeof(glm::vec4));
+        volumeMap->resize(sampleCount);
+        void* mappedData = _core->mapBuffer(readbackBuffer);
+        memcpy(volumeMap->data(), mappedData, sampleCount * sizeof(glm::vec4));
+        _core->unmapBuffer(readbackBuffer);
+        _core->destroyBuffer(readbackBuffer);
+    }
+
+    bakePass.destroy();
+    _core->destroyDescriptorPool(bakePool);
+    _core->destroyDescriptorSetLayout(bakeLayout);
+    _core->destroyBuffer(trianglesBuffer);
+    _core->destroyBuffer(clustersBuffer);
+    _core->destroyBuffer(groupsBuffer);
+    _core->destroyBuffer(samplesBuffer);
+    return image;
+}
+
 void GranularMatter::createSignedDistanceFields()
 {
 
-    glm::vec3 baseTextureSize = { 32, 32, 32 };
+    glm::vec3 baseTextureSize = glm::vec3((float)volumeMapResolution);
+    uint32_t cachedCount = 0;
     std::cout << "Generating volume maps..." << std::endl;
     for(auto rb : rigidBodies){
         //* Extend area by kernel radius
@@ -755,66 +1436,185 @@ void GranularMatter::createSignedDistanceFields()
         auto smallestDimension = std::min(baseSize.x, std::min(baseSize.y, baseSize.z));
 
         auto sizeRatio = baseSize / (smallestDimension);
-        glm::vec3 textureSize = glm::min(glm::ceil(baseTextureSize * sizeRatio), glm::vec3(128)); 
+        glm::vec3 textureSize = glm::min(glm::ceil(baseTextureSize * sizeRatio), glm::vec3(4.f * volumeMapResolution)); 
         std::cout << textureSize.x << " " << textureSize.y << " " << textureSize.z << std::endl;
-     
-        //* Get Sampling Step Size
-        glm::vec3 stepSize = aabb.size() / (textureSize);
+        glm::uvec3 size = glm::uvec3(textureSize);
+
+        //* Only triangle meshes are baked on the GPU, the analytic shapes are cheap on the CPU
+        Mesh3D* mesh = dynamic_cast<Mesh3D*>(rb);
+        bool bakeOnGPU = mesh != nullptr && volumeMapBake != VolumeMapBake::eCPU;
+        bool compareBakes = mesh != nullptr && volumeMapBake == VolumeMapBake::eCompare;
+
+        //* Everything the baked samples depend on. The backends differ on voxels near the medial axis, so each keeps its own maps
+        uint32_t bakeBackend = bakeOnGPU ? 1 : 0;
+        uint64_t key = rb->geometryHash();
+        key = hashBytes(&settings.h_LR, sizeof(settings.h_LR), key);
+        key = hashBytes(&settings.r_LR, sizeof(settings.r_LR), key);
+        key = hashBytes(&aabb, sizeof(aabb), key);
+        key = hashBytes(&size, sizeof(size), key);
+        key = hashBytes(&bakeBackend, sizeof(bakeBackend), key);
+        key = hashBytes(&VOLUME_MAP_CACHE_VERSION, sizeof(VOLUME_MAP_CACHE_VERSION), key);
+
+        auto transform = VolumeMapTransform();
+        transform.position = glm::vec4(rb->position + aabb.center(), 1.0);
+        transform.scale = glm::vec4((glm::vec3(1.0) / (rb->scale * aabb.size())), 1.0);
+        transform.resolution = glm::uvec4(size, 0);
+
+        //* A cached map is copied from its file mapping straight into the staging buffer
+        std::string cachePath = volumeMapCacheDirectory.empty() ? std::string() : volumeMapCachePath(volumeMapCacheDirectory, key);
+        MappedVolumeMap cachedVolumeMap;
         std::vector<glm::vec4> volumeMap;
-        for(int z = 0; z < textureSize.z; z++){
-            for(int y = 0; y < textureSize.y; y++){
-                for(int x = 0; x < textureSize.x; x++){
-                    glm::vec3 samplePoint = glm::vec3{
-                        aabb.min.x + x * stepSize.x + (0.5 * stepSize.x), 
-                        aabb.min.y + y * stepSize.y + (0.5 * stepSize.y), 
-                        aabb.min.z + z * stepSize.z + (0.5 * stepSize.z)  
-                    };
-                    
-                    float sd = rb->signedDistance(samplePoint) + settings.r_LR * 1.f;
-                    float volume = cubicExtension(sd);
+        const glm::vec4* samples = nullptr;
+        vk::Image image;
+        if(!compareBakes && !cachePath.empty() && cachedVolumeMap.open(cachePath, key, size)){
+            samples = cachedVolumeMap.data();
+            cachedCount++;
+        }
+        else{
+            if(bakeOnGPU){
+                //* The samples stay on the device unless they are cached, compared, split into bricks or encoded
+                bool download = compareBakes || !cachePath.empty() || sparseVolumeMaps || rb->volumeMapFormat != VolumeMapFormat::eFloat32;
+                image = bakeVolumeMapGPU(*mesh, aabb, size, download ? &volumeMap : nullptr);
+                if(compareBakes){
+                    //* Voxels on the medial axis have several nearest points, both bakes may pick a different one
+                    std::vector<glm::vec4> cpuVolumeMap = bakeVolumeMap(rb, aabb, size);
+                    float voxelSize = std::min(aabb.size().x / size.x, std::min(aabb.size().y / size.y, aabb.size().z / size.z));
+                    float maxVolumeError = 0.f;
+                    size_t offsetMismatches = 0;
+                    for(size_t i = 0; i < volumeMap.size(); i++){
+                        maxVolumeError = std::max(maxVolumeError, std::abs(volumeMap[i].w - cpuVolumeMap[i].w));
+                        if(glm::length(glm::vec3(volumeMap[i]) - glm::vec3(cpuVolumeMap[i])) > 0.5f * voxelSize){
+                            offsetMismatches++;
+                        }
+                    }
+                    std::cout << "GPU vs CPU bake: max volume error " << maxVolumeError << ", " << offsetMismatches << " of " << volumeMap.size() << " nearest points differ by more than half a voxel" << std::endl;
+                }
+            }
+            else{
+                volumeMap = bakeVolumeMap(rb, aabb, size);
+            }
+            if(!volumeMap.empty()){
+                samples = volumeMap.data();
+                if(!cachePath.empty() && !writeVolumeMapCache(cachePath, key, size, volumeMap)){
+                    std::cerr << "Could not write volume map cache " << cachePath << std::endl;
+                }
+            }
+        }
+
+        //* create vulkan texture, from the dense samples or the brick atlas
+        const glm::vec4* texels = samples;
+        glm::uvec3 textureSize3D = size;
+        VolumeMapBricks bricks;
+        if(samples != nullptr && sparseVolumeMaps){
+            bricks = buildVolumeMapBricks(samples, size, settings.h_LR, _core->getPhysicalDevice().getProperties().limits.maxImageDimension3D);
+            if(!bricks.table.empty()){
+                transform.resolution.w = 1;
+                transform.atlas = glm::uvec4(bricks.atlasSize, (uint32_t)volumeMapBrickTable.size());
+                volumeMapBrickTable.insert(volumeMapBrickTable.end(), bricks.table.begin(), bricks.table.end());
+
+                texels = bricks.atlas.data();
+                textureSize3D = bricks.atlasSize * VOLUME_MAP_BRICK_SAMPLES;
+                std::cout << "  " << bricks.allocatedCount << " of " << bricks.table.size() << " bricks in the narrow band, "
+                    << bricks.atlas.size() * sizeof(glm::vec4) / 1024 << " KiB instead of " << (size_t)size.x * size.y * size.z * sizeof(glm::vec4) / 1024 << " KiB" << std::endl;
+            }
+            else{
+                std::cerr << "Brick atlas exceeds the 3D image limits, the volume map stays dense" << std::endl;
+            }
+        }
+
+        VolumeMapFormat format = rb->volumeMapFormat;
+        if(format == VolumeMapFormat::eOctahedral && !(_core->getPhysicalDevice().getFormatProperties(vk::Format::eR16G16B16A16Snorm).optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage)){
+            std::cerr << "R16G16B16A16Snorm cannot be sampled on this device, the volume map uses fp16" << std::endl;
+            format = VolumeMapFormat::eFloat16;
+        }
+        vk::Format textureFormat = format == VolumeMapFormat::eFloat32 ? vk::Format::eR32G32B32A32Sfloat : format == VolumeMapFormat::eFloat16 ? vk::Format::eR16G16B16A16Sfloat : vk::Format::eR16G16B16A16Snorm;
 
-                    glm::vec3 nearestPoint = rb->signedDistanceGradient(samplePoint);
-                    nearestPoint += glm::normalize(rb->signedDistanceGradient(samplePoint)) * settings.r_LR * 1.f;
-                    volumeMap.push_back(glm::vec4(nearestPoint.x, nearestPoint.y, nearestPoint.z, volume));
+        if(!image && format == VolumeMapFormat::eFloat32){
+            image = _core->image3DFromData((void*)texels, vk::ImageUsageFlagBits::eSampled, vma::MemoryUsage::eAutoPreferDevice, {}, textureSize3D.x, textureSize3D.y, textureSize3D.z, textureFormat);
+        }
+        else if(!image){
+            size_t texelCount = (size_t)textureSize3D.x * textureSize3D.y * textureSize3D.z;
+            float lengthScale = format == VolumeMapFormat::eOctahedral ? volumeMapLengthScale(texels, texelCount) : 1.f;
+            std::vector<uint16_t> encoded = encodeVolumeMap(texels, texelCount, format, lengthScale);
+            transform.encoding = glm::uvec4((uint32_t)format, glm::floatBitsToUint(lengthScale), 0, 0);
+
+            if(validateVolumeMapFormats){
+                //* Only texels within h_LR of the surface are ever used by the solver. The shaders interpolate decoded
+                //* texels, so the error between texels is bounded by the error of its corners
+                float maxOffsetError = 0.f;
+                float maxVolumeError = 0.f;
+                for(size_t i = 0; i < texelCount; i++){
+                    glm::vec3 offset = glm::vec3(texels[i]);
+                    if(!(glm::length(offset) < settings.h_LR)){
+                        continue;
+                    }
+                    glm::vec4 decoded = decodeVolumeMapTexel(&encoded[4 * i], format, lengthScale);
+                    maxOffsetError = std::max(maxOffsetError, glm::length(glm::vec3(decoded) - offset));
+                    maxVolumeError = std::max(maxVolumeError, std::abs(decoded.w - texels[i].w));
                 }
+                std::cout << "  " << (format == VolumeMapFormat::eFloat16 ? "fp16" : "octahedral") << " encoding: max offset error " << maxOffsetError << " m (" << maxOffsetError / settings.h_LR * 100.f
+                    << " % of h_LR), max volume error " << maxVolumeError << " in the narrow band" << std::endl;
             }
+            image = _core->image3DFromData(encoded.data(), vk::ImageUsageFlagBits::eSampled, vma::MemoryUsage::eAutoPreferDevice, {}, textureSize3D.x, textureSize3D.y, textureSize3D.z, textureFormat);
         }
-        //* create vulkan texture
-        auto image = _core->image3DFromData(volumeMap.data(), vk::ImageUsageFlagBits::eSampled, vma::MemoryUsage::eAutoPreferDevice, {}, (uint32_t)textureSize.x, (uint32_t)textureSize.y, (uint32_t)textureSize.z, vk::Format::eR32G32B32A32Sfloat);
+        cachedVolumeMap.close();
         signedDistanceFields.push_back(image);
 
-        auto view = _core->createImageView3D(image, vk::Format::eR32G32B32A32Sfloat); 
+        auto view = _core->createImageView3D(image, textureFormat); 
         signedDistanceFieldViews.push_back(view);
         
-        auto transform = VolumeMapTransform();
-        transform.position = glm::vec4(rb->position + aabb.center(), 1.0);
-        transform.scale = glm::vec4((glm::vec3(1.0) / (rb->scale * aabb.size())), 1.0);
         volumeMapTransforms.push_back(transform);
     }
-    std::cout << " done." << std::endl;
+    std::cout << " done (" << cachedCount << " of " << rigidBodies.size() << " cached)." << std::endl;
     volumeMapSampler = _core->createSampler(vk::SamplerAddressMode::eClampToEdge);
 
     
     volumeMapTransformsBuffer = _core->bufferFromData(volumeMapTransforms.data(), volumeMapTransforms.size() * sizeof(VolumeMapTransform),vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferDevice);
 
+    //* Never bound empty, dense maps do not read it
+    if(volumeMapBrickTable.empty()){
+        volumeMapBrickTable.push_back(VOLUME_MAP_EMPTY_BRICK);
+    }
+    volumeMapBrickTableBuffer = _core->bufferFromData(volumeMapBrickTable.data(), volumeMapBrickTable.size() * sizeof(uint32_t), vk::BufferUsageFlagBits::eStorageBuffer, vma::MemoryUsage::eAutoPreferDevice);
+
 }
 
 
 void GranularMatter::destroy(){
     destroyFrameResources();
     vk::Device device = _core->getDevice();
+    if(prerecordSubsteps){
+        device.freeCommandBuffers(_core->getCommandPool(), substepCommandBuffers);
+    }
+    for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
+        if(!substepSegmentCommandBuffers[i].empty()){
+            device.freeCommandBuffers(_core->getCommandPool(), substepSegmentCommandBuffers[i]);
+        }
+    }
 
     initPass.destroy();
     bitonicSortPass.destroy();
-    startingIndicesPass.destroy();
+    radixHistogramPass.destroy();
+    prefixSumPass.destroy();
+    radixScatterPass.destroy();
+    countingSortCountPass.destroy();
+    countingSortScatterPass.destroy();
+    cellRangesPass.destroy();
+    reorderParticlesPass.destroy();
+    packParticlesPass.destroy();
     computeDensityPass.destroy();
     computeSurfaceNormalPass.destroy();
     
     iisphvAdvPass.destroy();
     iisphRhoAdvPass.destroy();
+    buildNeighborListPass.destroy();
+    fusedNeighborListDensityPass.destroy();
+    fusedIISPHAdvectionPass.destroy();
     iisphdijpjSolvePass.destroy();
     iisphPressureSolvePass.destroy();
     iisphSolveEndPass.destroy();
+    iisphConvergencePass.destroy();
+    updateActiveParticlesPass.destroy();
 
     computeStressPass.destroy();
     computeInternalForcePass.destroy();
@@ -827,20 +1627,51 @@ void GranularMatter::destroy(){
 
     for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
         _core->destroyBuffer(additionalDataBuffer[i]);
+        _core->destroyBuffer(substepHistoryBuffers[i]);
+        _core->destroyBuffer(pressureSolveDispatchBuffers[i]);
+        _core->destroyBuffer(densityErrorPartialsBuffers[i]);
+        _core->destroyBuffer(activeParticlesBuffers[i]);
+        _core->destroyBuffer(settingsBuffers[i]);
+        _core->destroyBuffer(convergenceParamsBuffers[i]);
         
     }
 
     _core->destroyBuffer(particlesBufferB);
     _core->destroyBuffer(particlesBufferHR);
+    _core->destroyBuffer(colorPaletteBuffer);
     _core->destroyBuffer(particleCellBuffer);
-    _core->destroyBuffer(startingIndicesBuffers);
+    _core->destroyBuffer(cellRangesBuffer);
+    if(pipelinedHRAdvection){
+        for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
+            _core->destroyBuffer(snapshotKinematicsBuffers[i]);
+            _core->destroyBuffer(snapshotDensityBuffers[i]);
+            _core->destroyBuffer(snapshotParticleCellBuffers[i]);
+            _core->destroyBuffer(snapshotCellRangesBuffers[i]);
+        }
+    }
+    _core->destroyBuffer(sortTempBuffer);
+    _core->destroyBuffer(radixHistogramBuffer);
+    _core->destroyBuffer(cellCountsBuffer);
+    _core->destroyBuffer(particleIdsBuffer);
+    _core->destroyBuffer(particleIdsReorderBuffer);
+    for (size_t stream = 0; stream < LRParticleStream::eStreamCount; stream++) {
+        _core->destroyBuffer(particleStreamBuffers[stream]);
+        _core->destroyBuffer(particleStreamReorderBuffers[stream]);
+    }
+    _core->destroyBuffer(neighborCountsBuffer);
+    _core->destroyBuffer(neighborsBuffer);
+    _core->destroyBuffer(neighborGradWBuffer);
 
     _core->destroyDescriptorSetLayout(descriptorSetLayoutGrid);
+    _core->destroyDescriptorSetLayout(descriptorSetLayoutRadixSort);
+    _core->destroyDescriptorSetLayout(descriptorSetLayoutPrefixSum);
+    _core->destroyDescriptorSetLayout(descriptorSetLayoutReorder);
     _core->destroyDescriptorSetLayout(descriptorSetLayoutParticles);
     
     _core->destroyDescriptorPool(descriptorPool);
 
     _core->destroyBuffer(volumeMapTransformsBuffer);
+    _core->destroyBuffer(volumeMapBrickTableBuffer);
     for(auto view : signedDistanceFieldViews){
         _core->destroyImageView(view);
     }
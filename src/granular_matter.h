@@ -1,7 +1,9 @@
+#pragma once
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include "core.h"
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 #include "compute_pass.h"
 #include "global.h"
 #include "rigidbody.h"
@@ -17,11 +19,46 @@ struct BitonicSortParameters {
     eAlgorithmVariant algorithm;
 };
 
+struct SortParameters {
+    uint32_t shift = 0;
+    uint32_t count = 0;
+};
+
+struct PrefixSumParameters {
+    uint32_t count = 0;
+};
+
+struct ParticlePassParameters {
+    uint32_t count = 0;
+};
+
+struct PressureSolveConvergenceParameters {
+    float threshold = 0.f;
+    ConvergenceCriterion criterion = ConvergenceCriterion::eAverageDensityError;
+    uint32_t minIterations = 2;
+    uint32_t pad0 = 0;
+};
+
 struct ParticleGridEntry{
     uint32_t particleIndex = 0;
     uint32_t cellKey = UINT32_MAX;
 };
 
+//* Symmetric 3x3 tensor, only the upper triangle is stored, matches SymmetricMat3 in the shaders
+struct SymmetricMat3{
+    float xx = 0.f;
+    float yy = 0.f;
+    float zz = 0.f;
+    float xy = 0.f;
+    float xz = 0.f;
+    float yz = 0.f;
+
+    SymmetricMat3(){};
+    inline SymmetricMat3(const glm::mat3& m) : xx(m[0][0]), yy(m[1][1]), zz(m[2][2]),
+        xy(0.5f * (m[1][0] + m[0][1])), xz(0.5f * (m[2][0] + m[0][2])), yz(0.5f * (m[2][1] + m[1][2])) {}
+    inline glm::mat3 toMat3() const { return glm::mat3(xx, xy, xz, xy, yy, yz, xz, yz, zz); }
+};
+
 struct LRParticle{
     glm::vec4 position = glm::vec4(0);
     glm::vec4 velocity = glm::vec4(0);
@@ -29,8 +66,8 @@ struct LRParticle{
     glm::vec4 internalForce = glm::vec4(0);
     glm::vec4 d = glm::vec4(0);
     glm::vec4 dijpj = glm::vec4(0);
-    glm::mat4 stress = glm::mat4(0.0);
-    glm::mat4 deviatoricStress = glm::mat4(0.0);
+    SymmetricMat3 stress;
+    SymmetricMat3 deviatoricStress;
 
     float rho = settings.rho0;
     float p = 0.0;
@@ -64,6 +101,70 @@ struct LRParticle{
     }
 };
 
+//* Structure of arrays streams of the LR particles, the simulation passes read and write these.
+//* The interleaved LRParticle buffer is only used for uploads and as vertex input.
+struct LRParticleKinematics{
+    glm::vec3 position = glm::vec3(0);
+    uint32_t sleepSteps = 0;                            //* substeps below settings.sleepingSpeed
+    glm::vec3 velocity = glm::vec3(0);
+    float pad0 = 0.0;
+};
+
+struct LRParticleDensity{
+    float rho = settings.rho0;
+    float p = 0.0;
+    float lastP = 0.0;
+    float V = 0.0;
+};
+
+struct LRParticleSolver{
+    glm::vec4 d = glm::vec4(0);
+    glm::vec4 dijpj = glm::vec4(0);
+    float a = 0.0;
+    float dpi = 0.0;
+    float densityAdv = 0.0;
+    float pad0 = 0.0;
+};
+
+struct LRParticleStress{
+    SymmetricMat3 stress;
+    SymmetricMat3 deviatoricStress;
+};
+
+struct LRParticleForces{
+    glm::vec4 externalForce = glm::vec4(0);
+    glm::vec4 internalForce = glm::vec4(0);
+    glm::vec4 averageN = glm::vec4(0);
+    glm::vec4 color = glm::vec4(0);
+};
+
+//* Stiffness tensor without the 1 / dt factor, built by compute_stress.comp at the density rho
+struct LRParticleStiffness{
+    SymmetricMat3 D;
+    float rho = 0.0;                                    //* 0: not built yet
+    float pad0 = 0.0;
+};
+
+enum LRParticleStream : uint32_t {
+    eKinematics = 0,
+    eDensity = 1,
+    eSolver = 2,
+    eStress = 3,
+    eForces = 4,
+    eStiffness = 5,
+    eStreamCount = 6,
+};
+
+const uint32_t LR_PARTICLE_STREAM_BINDING = 8;         //* binding of eKinematics in the particle descriptor set, the others follow
+const std::array<size_t, LRParticleStream::eStreamCount> LR_PARTICLE_STREAM_SIZES = {
+    sizeof(LRParticleKinematics),
+    sizeof(LRParticleDensity),
+    sizeof(LRParticleSolver),
+    sizeof(LRParticleStress),
+    sizeof(LRParticleForces),
+    sizeof(LRParticleStiffness),
+};
+
 struct HRParticle{
     glm::vec4 position = glm::vec4(0);
     glm::vec4 velocity = glm::vec4(0);  
@@ -87,19 +188,61 @@ struct HRParticle{
     }
 };
 
+//* HRParticleFormat::eCompact, matches encodeCompactHRParticle in hr_advection.comp
+//* x: cell of size h_LR, 8 bit biased per axis, palette index in the top 8 bits
+//* y: unorm16 offset x, y in the cell, z: unorm16 offset z | fp16 velocity x, w: fp16 velocity y, z
+struct CompactHRParticle{
+    glm::uvec4 data = glm::uvec4(0);
+    CompactHRParticle(){};
+    inline CompactHRParticle(const HRParticle& p, uint32_t paletteIndex, float cellSize) {
+        glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor(glm::vec3(p.position) / cellSize)), glm::ivec3(-128), glm::ivec3(127));
+        glm::vec3 offset = glm::clamp(glm::vec3(p.position) / cellSize - glm::vec3(cell), 0.f, 1.f);
+        glm::uvec3 biasedCell = glm::uvec3(cell + 128);
+        data.x = biasedCell.x | (biasedCell.y << 8) | (biasedCell.z << 16) | (paletteIndex << 24);
+        data.y = glm::packUnorm2x16(glm::vec2(offset.x, offset.y));
+        data.z = (glm::packUnorm2x16(glm::vec2(offset.z, 0.f)) & 0xffff) | (glm::packHalf2x16(glm::vec2(p.velocity.x, 0.f)) << 16);
+        data.w = glm::packHalf2x16(glm::vec2(p.velocity.y, p.velocity.z));
+    }
+    static const uint32_t BINDING = 1;
+    static std::array<vk::VertexInputBindingDescription, 1> getBindingDescription() {
+        std::array<vk::VertexInputBindingDescription, 1> bindingDescriptions = {
+            vk::VertexInputBindingDescription(BINDING, sizeof(CompactHRParticle), vk::VertexInputRate::eInstance)
+        };
+        return bindingDescriptions;
+    }
+    static std::array<vk::VertexInputAttributeDescription, 1> getAttributeDescriptions() {
+        std::array<vk::VertexInputAttributeDescription, 1> attributeDescriptions{
+            vk::VertexInputAttributeDescription(7, BINDING, vk::Format::eR32G32B32A32Uint, offsetof(CompactHRParticle, data)),
+        };
+        return attributeDescriptions;
+    }
+};
+
 struct VolumeMapTransform{
     glm::vec4 position = glm::vec4(0.0);
     glm::vec4 scale = glm::vec4(1.0);
+    glm::uvec4 resolution = glm::uvec4(0);              //* xyz: voxels of the dense map, w: 1 if the map is stored as bricks
+    glm::uvec4 atlas = glm::uvec4(0);                   //* xyz: bricks per axis of the brick atlas, w: first entry in the brick table
+    glm::uvec4 encoding = glm::uvec4(0);                //* x: VolumeMapFormat, y: float bits of the octahedral offset length scale
 
     inline void disable(){ position.w = 0.0; };
     inline void enable(){ position.w = 1.0; };
 };
 
 struct AdditionalData{
-    glm::mat4 D = glm::mat4(0.0);
     float averageDensityError = 0.f;
-    uint32_t frameIndex = 0;
-    float pad[2];
+    float maxDensityError = 0.f;
+    uint32_t iterationCount = 0;
+    float maxVelocity = 0.f;                            //* m/s, of the last substep
+    float maxAcceleration = 0.f;                        //* m/s^2, of the last substep
+    uint32_t stiffnessRefreshCount = 0;                 //* particles that rebuilt their stiffness tensor in the last substep
+    uint32_t activeParticleCount = 0;                   //* copied from the active particle list, not declared in the shaders
+};
+
+//* Header of the active particle list, the indices of the awake particles follow it
+struct ActiveParticlesHeader{
+    vk::DispatchIndirectCommand dispatch = vk::DispatchIndirectCommand(0, 1, 1);
+    uint32_t activeCount = 0;
 };
 
 class GranularMatter
@@ -114,7 +257,9 @@ public:
     std::vector<HRParticle> hrParticles;
     std::vector<HRParticle> hrParticles2;
     vk::Buffer particlesBufferB;
-    vk::Buffer particlesBufferHR;
+    vk::Buffer particlesBufferHR;                       //* HRParticle or CompactHRParticle, see hrParticleFormat
+    std::vector<glm::vec4> colorPalette;                //* at most 256 colors, CompactHRParticle stores an 8 bit index
+    vk::Buffer colorPaletteBuffer;                      //* read by the particle vertex shader in the compact HR format
 
     inline vk::CommandBuffer getCommandBuffer(int index){ return commandBuffers[index]; };
     void initFrameResources();
@@ -124,8 +269,8 @@ public:
     void init();
 
     void createSignedDistanceFields();
+    void loadScene(int scene);
 
-    std::vector<vk::Semaphore> iisphSemaphores;
 
     std::vector<RigidBody2D*> rigidBodies;
     std::vector<VolumeMapTransform> volumeMapTransforms;
@@ -133,42 +278,100 @@ public:
     void updateVolumeMapTransforms();
 private:
     gpu::Core* _core;
+
+    std::vector<glm::vec4> bakeVolumeMap(RigidBody2D* rb, AABB aabb, glm::uvec3 size);
+    //* Returns the baked image, if volumeMap is not null the samples are read back into it instead
+    vk::Image bakeVolumeMapGPU(const Mesh3D& mesh, AABB aabb, glm::uvec3 size, std::vector<glm::vec4>* volumeMap);
     
 
     AdditionalData additionalData;
     std::vector<vk::Buffer>additionalDataBuffer;
-    std::vector<vk::Fence> iisphFences;
+    std::vector<vk::Buffer> pressureSolveDispatchBuffers;
+    std::vector<vk::Buffer> densityErrorPartialsBuffers;
+    std::vector<vk::Buffer> activeParticlesBuffers;     //* ActiveParticlesHeader and the awake particle indices
+    std::vector<vk::Buffer> settingsBuffers;            //* SPHSettings of the substep passes, written every frame
+    std::vector<vk::Buffer> convergenceParamsBuffers;
+    std::vector<vk::Buffer> substepHistoryBuffers;      //* AdditionalData per substep, read when the frame index comes around again
+    std::vector<uint32_t> substepHistoryCapacities;
+    std::vector<uint32_t> substepHistoryCounts;
+    uint64_t lastSubstepTimelineValue = 0;              //* timeline value signaled by the latest substep segment
+    size_t lastSubstepFrame = 0;
 
 
-    std::vector<vk::CommandBuffer> commandBuffers;
+    std::vector<vk::CommandBuffer> commandBuffers;      //* passes after the substeps, submitted by the application
+    std::vector<std::vector<vk::CommandBuffer>> substepSegmentCommandBuffers;  //* one per substep, queued on the timeline
+    std::vector<vk::CommandBuffer> hrAdvectionCommandBuffers;   //* pipelined HR advection, submitted on the async timeline
+    std::vector<uint64_t> hrAdvectionTimelineValues;
+    std::vector<vk::CommandBuffer> substepCommandBuffers;  //* secondary, recorded once at init when prerecordSubsteps is set
     
     vk::Buffer volumeMapTransformsBuffer;
+    std::vector<uint32_t> volumeMapBrickTable;          //* atlas slot per brick of every sparse volume map
+    vk::Buffer volumeMapBrickTableBuffer;
     
     std::vector<ParticleGridEntry> particleCells; // particle (index) is in cell (value)
-    std::vector<uint32_t> startingIndices; 
+    std::vector<glm::uvec2> cellRanges;                 //* [begin, end) in particleCells per cell key
     
     vk::Buffer particleCellBuffer;
-    vk::Buffer startingIndicesBuffers;
+    vk::Buffer cellRangesBuffer;
+    vk::Buffer sortTempBuffer;
+    vk::Buffer radixHistogramBuffer;
+    vk::Buffer cellCountsBuffer;
+
+    std::vector<uint32_t> particleIds;                  //* identity, original particle id per position in the particle streams
+    vk::Buffer particleIdsBuffer;                       //* original particle id per position, follows the reorder
+    vk::Buffer particleIdsReorderBuffer;
+    std::array<vk::Buffer, LRParticleStream::eStreamCount> particleStreamBuffers;
+    std::vector<vk::Buffer> snapshotKinematicsBuffers;  //* LR state after the last substep of a frame, read by the pipelined HR advection
+    std::vector<vk::Buffer> snapshotDensityBuffers;
+    std::vector<vk::Buffer> snapshotParticleCellBuffers;
+    std::vector<vk::Buffer> snapshotCellRangesBuffers;
+    std::array<vk::Buffer, LRParticleStream::eStreamCount> particleStreamReorderBuffers;
+
+    vk::Buffer neighborCountsBuffer;
+    vk::Buffer neighborsBuffer;                         //* maxNeighbors particle indices per particle
+    vk::Buffer neighborGradWBuffer;                     //* maxNeighbors kernel gradients per particle
 
     std::vector<vk::DescriptorSet> descriptorSetsGrid;
     std::vector<vk::DescriptorSet> descriptorSetsParticles;
+    std::vector<vk::DescriptorSet> descriptorSetsHRAdvection;       //* pipelined HR advection, the LR snapshot instead of the live streams
+    std::vector<vk::DescriptorSet> descriptorSetsHRAdvectionGrid;
+    std::vector<vk::DescriptorSet> descriptorSetsRadixSort;
+    vk::DescriptorSet descriptorSetRadixHistogramPrefixSum;
+    vk::DescriptorSet descriptorSetCountingSort;
+    vk::DescriptorSet descriptorSetCellCountsPrefixSum;
+    vk::DescriptorSet descriptorSetReorder;
 
     vk::DescriptorSetLayout descriptorSetLayoutGrid;
     vk::DescriptorSetLayout descriptorSetLayoutParticles;
+    vk::DescriptorSetLayout descriptorSetLayoutRadixSort;
+    vk::DescriptorSetLayout descriptorSetLayoutPrefixSum;
+    vk::DescriptorSetLayout descriptorSetLayoutReorder;
 
     vk::DescriptorPool descriptorPool;
  
     gpu::ComputePass initPass;
     gpu::ComputePass bitonicSortPass;
-    gpu::ComputePass startingIndicesPass;
+    gpu::ComputePass radixHistogramPass;
+    gpu::ComputePass prefixSumPass;
+    gpu::ComputePass radixScatterPass;
+    gpu::ComputePass countingSortCountPass;
+    gpu::ComputePass countingSortScatterPass;
+    gpu::ComputePass cellRangesPass;
+    gpu::ComputePass reorderParticlesPass;
+    gpu::ComputePass packParticlesPass;
     gpu::ComputePass computeDensityPass;
     gpu::ComputePass computeSurfaceNormalPass;
 
     gpu::ComputePass iisphvAdvPass;
     gpu::ComputePass iisphRhoAdvPass;
+    gpu::ComputePass buildNeighborListPass;
     gpu::ComputePass iisphdijpjSolvePass;
     gpu::ComputePass iisphPressureSolvePass;
     gpu::ComputePass iisphSolveEndPass;
+    gpu::ComputePass iisphConvergencePass;
+    gpu::ComputePass fusedNeighborListDensityPass;
+    gpu::ComputePass updateActiveParticlesPass;
+    gpu::ComputePass fusedIISPHAdvectionPass;
 
     gpu::ComputePass computeStressPass;
     gpu::ComputePass computeInternalForcePass;
@@ -180,6 +383,11 @@ private:
     vk::Sampler volumeMapSampler;
 
     void createCommandBuffers();
+    void recordSubstepSolve(vk::CommandBuffer commandBuffer, size_t frame, std::vector<std::string>* labels);
+    void recordSubstepCommandBuffers();
+    void uploadLRParticles(std::vector<LRParticle>& particles);
+    void uploadHRParticles(std::vector<HRParticle>& particles);
+    size_t hrParticleSize();
     void createDescriptorSetLayout();
     void createDescriptorPool();
     
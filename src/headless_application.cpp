@@ -0,0 +1,266 @@
+#include "headless_application.h"
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <initializer_list>
+#include "global.h"
+
+void printHeadlessUsage(const char* name, bool interactive){
+    std::cerr << "Usage: " << name << (interactive ? " [--headless]" : "") << " [--scene S] [--dt DT] [--substeps N|auto] [--frames N] [--grid hash|dense] [--hash-table-size N] [--hr-format full|compact] [--kernels separate|fused] [--sleeping on|off] [--stiffness-tolerance T] [--commands record|replay] [--hr-advection inline|pipelined] [--volume-map-cache DIR|off] [--volume-map-bake cpu|gpu|compare] [--volume-map-resolution N] [--volume-maps dense|sparse] [--volume-map-format f32|f16|octahedral] [--volume-map-validation on|off]" << std::endl;
+    if(interactive){
+        std::cerr << "  --headless     run without window for --frames frames, required by --scene, --dt, --substeps and --frames" << std::endl;
+    }
+    std::cerr << "  --scene S      0: dump truck, 1: plane, 2: hourglas (default 0)" << std::endl;
+    std::cerr << "  --dt DT        fixed timestep per frame in seconds (default 0.016)" << std::endl;
+    std::cerr << "  --substeps N   solver substeps per frame, auto: chosen per frame from the CFL condition (default 3)" << std::endl;
+    std::cerr << "  --frames N     number of frames to simulate (default 1000)" << std::endl;
+    std::cerr << "  --grid G       neighborhood grid, hash: spatial hash, dense: uniform grid over the domain (default hash)" << std::endl;
+    std::cerr << "  --hash-table-size N  cells of the spatial hash table (default: one per particle)" << std::endl;
+    std::cerr << "  --hr-format F  HR particle storage, full: fp32, compact: quantized position, fp16 velocity, palette color (default full)" << std::endl;
+    std::cerr << "  --kernels K    fused: passes sharing a neighborhood traversal run as one kernel (default separate)" << std::endl;
+    std::cerr << "  --sleeping S   on: resting particles sleep and are skipped until a neighbor moves (default off)" << std::endl;
+    std::cerr << "  --stiffness-tolerance T  relative density change that rebuilds a cached stiffness tensor, negative: every substep (default 0.05)" << std::endl;
+    std::cerr << "  --commands C   record: the substep passes are recorded every substep, replay: recorded once at init and replayed (default record)" << std::endl;
+    std::cerr << "  --hr-advection A  pipelined: HR advection runs on the async compute queue from a snapshot of the LR state and overlaps the next frame (default inline)" << std::endl;
+    std::cerr << "  --volume-map-cache D  directory of the baked volume map cache, off: always bake (default volume_map_cache in the build directory)" << std::endl;
+    std::cerr << "  --volume-map-bake B  where mesh volume maps are baked, compare: on both, prints the deviation and uses the GPU result (default cpu)" << std::endl;
+    std::cerr << "  --volume-map-resolution N  volume map samples along the shortest axis, up to 4N along the others (default 32)" << std::endl;
+    std::cerr << "  --volume-maps V  sparse: only the bricks around the surface are kept, in an atlas with a brick table (default dense)" << std::endl;
+    std::cerr << "  --volume-map-format F  texels of every volume map, f16: half floats, octahedral: 16 bit direction, length and volume (default f32)" << std::endl;
+    std::cerr << "  --volume-map-validation V  on: prints the error of compact volume map formats against the fp32 bake (default off)" << std::endl;
+}
+
+//* Matches value against the names of a two or three way option, false if it is none of them
+template<typename T>
+static bool parseChoice(const std::string& value, std::initializer_list<std::pair<const char*, T>> choices, T& result){
+    for (const auto& choice : choices) {
+        if(value == choice.first){
+            result = choice.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+static OptionsResult parseHeadlessOptionList(int argc, char* argv[], HeadlessOptions& options, bool* headless){
+    bool headlessOnlyOptions = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--help" || arg == "-h"){
+            return OptionsResult::eHelp;
+        }
+        if(arg == "--headless" && headless != nullptr){
+            *headless = true;
+            continue;
+        }
+        if(i + 1 >= argc){
+            return OptionsResult::eInvalid;
+        }
+        std::string value = argv[++i];
+        bool valid = true;
+        if(arg == "--scene"){
+            options.scene = std::stoi(value);
+            valid = options.scene >= 0 && options.scene <= 2;
+            headlessOnlyOptions = true;
+        }
+        else if(arg == "--dt"){
+            options.dt = std::stof(value);
+            valid = options.dt > 0.f;
+            headlessOnlyOptions = true;
+        }
+        else if(arg == "--substeps"){
+            options.adaptiveTimestep = value == "auto";
+            if(!options.adaptiveTimestep){
+                options.substeps = std::stoi(value);
+                valid = options.substeps >= 1;
+            }
+            headlessOnlyOptions = true;
+        }
+        else if(arg == "--frames"){
+            options.frameCount = (uint32_t)std::stoul(value);
+            valid = options.frameCount > 0;
+            headlessOnlyOptions = true;
+        }
+        else if(arg == "--grid"){
+            valid = parseChoice(value, { { "hash", GridMode::eSpatialHash }, { "dense", GridMode::eDense } }, options.gridMode);
+        }
+        else if(arg == "--hash-table-size"){
+            options.hashTableSize = (uint32_t)std::stoul(value);
+        }
+        else if(arg == "--hr-format"){
+            valid = parseChoice(value, { { "full", HRParticleFormat::eFull }, { "compact", HRParticleFormat::eCompact } }, options.hrParticleFormat);
+        }
+        else if(arg == "--kernels"){
+            valid = parseChoice(value, { { "separate", false }, { "fused", true } }, options.fuseKernels);
+        }
+        else if(arg == "--sleeping"){
+            valid = parseChoice(value, { { "off", false }, { "on", true } }, options.sleepingParticles);
+        }
+        else if(arg == "--stiffness-tolerance"){
+            options.stiffnessRefreshTolerance = std::stof(value);
+        }
+        else if(arg == "--commands"){
+            valid = parseChoice(value, { { "record", false }, { "replay", true } }, options.prerecordSubsteps);
+        }
+        else if(arg == "--hr-advection"){
+            valid = parseChoice(value, { { "inline", false }, { "pipelined", true } }, options.pipelinedHRAdvection);
+        }
+        else if(arg == "--volume-map-cache"){
+            options.volumeMapCacheDirectory = value == "off" ? std::string() : value;
+        }
+        else if(arg == "--volume-map-bake"){
+            valid = parseChoice(value, { { "cpu", VolumeMapBake::eCPU }, { "gpu", VolumeMapBake::eGPU }, { "compare", VolumeMapBake::eCompare } }, options.volumeMapBake);
+        }
+        else if(arg == "--volume-map-resolution"){
+            options.volumeMapResolution = (uint32_t)std::stoul(value);
+            valid = options.volumeMapResolution > 0;
+        }
+        else if(arg == "--volume-maps"){
+            valid = parseChoice(value, { { "dense", false }, { "sparse", true } }, options.sparseVolumeMaps);
+        }
+        else if(arg == "--volume-map-format"){
+            valid = parseChoice(value, { { "f32", VolumeMapFormat::eFloat32 }, { "f16", VolumeMapFormat::eFloat16 }, { "octahedral", VolumeMapFormat::eOctahedral } }, options.volumeMapFormat);
+        }
+        else if(arg == "--volume-map-validation"){
+            valid = parseChoice(value, { { "off", false }, { "on", true } }, options.validateVolumeMapFormats);
+        }
+        else{
+            valid = false;
+        }
+        if(!valid){
+            return OptionsResult::eInvalid;
+        }
+    }
+    if(headless != nullptr && !*headless && headlessOnlyOptions){
+        return OptionsResult::eInvalid;
+    }
+    return OptionsResult::eRun;
+}
+
+OptionsResult parseHeadlessOptions(int argc, char* argv[], HeadlessOptions& options, bool* headless){
+    OptionsResult result;
+    try {
+        result = parseHeadlessOptionList(argc, argv, options, headless);
+    } catch (const std::exception&) {
+        //* std::stoi, std::stoul and std::stof throw on values that are not numbers
+        result = OptionsResult::eInvalid;
+    }
+    if(result != OptionsResult::eRun){
+        printHeadlessUsage(argv[0], headless != nullptr);
+    }
+    return result;
+}
+
+void applyHeadlessOptions(const HeadlessOptions& options){
+    gridMode = options.gridMode;
+    hashTableSize = options.hashTableSize;
+    hrParticleFormat = options.hrParticleFormat;
+    fuseKernels = options.fuseKernels;
+    sleepingParticles = options.sleepingParticles;
+    stiffnessRefreshTolerance = options.stiffnessRefreshTolerance;
+    prerecordSubsteps = options.prerecordSubsteps;
+    pipelinedHRAdvection = options.pipelinedHRAdvection;
+    volumeMapCacheDirectory = options.volumeMapCacheDirectory;
+    volumeMapBake = options.volumeMapBake;
+    volumeMapResolution = options.volumeMapResolution;
+    sparseVolumeMaps = options.sparseVolumeMaps;
+    volumeMapFormat = options.volumeMapFormat;
+    validateVolumeMapFormats = options.validateVolumeMapFormats;
+}
+
+HeadlessApplication::HeadlessApplication(HeadlessOptions options)
+{
+    _options = options;
+}
+
+void HeadlessApplication::run(){
+    initVulkan();
+    mainLoop();
+    cleanup();
+}
+
+void HeadlessApplication::initVulkan(){
+    core = gpu::Core(false);
+
+    device = core.getDevice();
+
+    core.createComputeContext(computeContext);
+
+    //* The grid configuration is read when the simulation buffers are created
+    applyHeadlessOptions(_options);
+
+    simulation = GranularMatter(&core);
+
+    // Load rigidbodies for simulation
+    dumpTruck = Mesh3D(ASSETS_PATH"/models/dump_truck.glb");
+    plane = Mesh3D(ASSETS_PATH"/models/plane.glb");
+    hourglas = Mesh3D(ASSETS_PATH"/models/hourglas.glb");
+    dumpTruck.volumeMapFormat = volumeMapFormat;
+    plane.volumeMapFormat = volumeMapFormat;
+    hourglas.volumeMapFormat = volumeMapFormat;
+
+    // create signed distance fields
+    simulation.rigidBodies.push_back(&dumpTruck);
+    simulation.rigidBodies.push_back(&plane);
+    simulation.rigidBodies.push_back(&hourglas);
+    simulation.createSignedDistanceFields();
+
+    simulation.init();
+    simulation.loadScene(_options.scene);
+
+    //* Fixed timestep, update() clamps the frame time to maxTimestep
+    substeps = _options.substeps;
+    adaptiveTimestep = _options.adaptiveTimestep;
+    settings.maxTimestep = _options.dt;
+
+    simulationRunning = true;
+}
+
+void HeadlessApplication::stepFrame(size_t currentFrame){
+    vk::Result result;
+    result = device.waitForFences(computeContext._frames[currentFrame]._inFlight, VK_TRUE, UINT64_MAX);
+
+    device.resetFences(computeContext._frames[currentFrame]._inFlight);
+
+    //* Always advance by the fixed timestep, there is no wall clock to follow
+    simulation.update((int)currentFrame, 0, _options.dt);
+    substepCount += substeps;
+
+    //* Queued behind the substep segments on the timeline, the fence only guards the reuse of this frame's resources
+    core.submitTimeline(core.getComputeQueue(), simulation.getCommandBuffer((int)currentFrame), vk::PipelineStageFlagBits::eComputeShader, computeContext._frames[currentFrame]._inFlight);
+}
+
+void HeadlessApplication::mainLoop(){
+    std::chrono::high_resolution_clock::time_point startTime = std::chrono::high_resolution_clock::now();
+
+    for (uint32_t frame = 0; frame < _options.frameCount; frame++) {
+        stepFrame(frame % gpu::MAX_FRAMES_IN_FLIGHT);
+    }
+    device.waitIdle();
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    double wallTime = std::chrono::duration<double, std::chrono::seconds::period>(endTime - startTime).count();
+
+    double frameCount = (double)_options.frameCount;
+    double particleSteps = (double)substepCount * (double)simulation.lrParticles.size();
+
+    std::cout << "Scene:             " << _options.scene << std::endl;
+    std::cout << "Particles (LR/HR): " << simulation.lrParticles.size() << " / " << simulation.hrParticles.size() << std::endl;
+    std::cout << "Frames:            " << _options.frameCount << " x " << (double)substepCount / frameCount << " substeps" << (_options.adaptiveTimestep ? " (adaptive)" : "") << ", dt = " << _options.dt << " s" << std::endl;
+    if(_options.sleepingParticles){
+        std::cout << "Awake particles:   " << simulationMetrics.activeParticleCount << " of " << simulation.lrParticles.size() << " in the last substep" << std::endl;
+    }
+    std::cout << "Simulated time:    " << frameCount * _options.dt << " s" << std::endl;
+    std::cout << "Wall time:         " << wallTime << " s" << std::endl;
+    std::cout << "Time per frame:    " << (wallTime / frameCount) * 1000.0 << " ms" << std::endl;
+    std::cout << "Throughput:        " << frameCount / wallTime << " frames/s, " << particleSteps / wallTime << " particle steps/s" << std::endl;
+}
+
+void HeadlessApplication::cleanup(){
+    device.waitIdle();
+
+    simulation.destroy();
+
+    core.destroyComputeContext(computeContext);
+}
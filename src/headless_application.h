@@ -0,0 +1,66 @@
+#pragma once
+
+#include "core.h"
+#include "granular_matter.h"
+#include "rigidbody.h"
+
+struct HeadlessOptions{
+    uint32_t frameCount = 1000;
+    int scene = 0;
+    float dt = 0.016f;                                  //* s, fixed timestep per frame
+    int substeps = 3;
+    bool adaptiveTimestep = false;                      //* substeps chosen per frame, substeps is ignored
+    GridMode gridMode = GridMode::eSpatialHash;
+    uint32_t hashTableSize = 0;                         //* 0: one cell per LR particle
+    HRParticleFormat hrParticleFormat = HRParticleFormat::eFull;
+    bool fuseKernels = false;
+    bool sleepingParticles = false;
+    float stiffnessRefreshTolerance = 0.05f;            //* relative density change, negative: rebuild every substep
+    bool prerecordSubsteps = false;                     //* replay the substep solve from secondary command buffers recorded at init
+    bool pipelinedHRAdvection = false;                  //* HR advection of a frame overlaps the LR solve of the next one
+    std::string volumeMapCacheDirectory = VOLUME_MAP_CACHE_PATH;  //* in the build directory, empty: always bake the volume maps
+    VolumeMapBake volumeMapBake = VolumeMapBake::eCPU;
+    uint32_t volumeMapResolution = 32;
+    bool sparseVolumeMaps = false;                      //* brick atlas around the surface instead of a dense texture
+    VolumeMapFormat volumeMapFormat = VolumeMapFormat::eFloat32;   //* of every rigid body
+    bool validateVolumeMapFormats = false;
+};
+
+enum class OptionsResult{
+    eRun = 0,
+    eHelp = 1,                                          //* usage printed on request
+    eInvalid = 2,                                       //* usage printed for an unknown option or value
+};
+
+//* Command line of both executables. headless is null for the batch runner, which always runs headless and does
+//* not accept --headless. The interactive executable only accepts --scene, --dt, --substeps and --frames with --headless
+OptionsResult parseHeadlessOptions(int argc, char* argv[], HeadlessOptions& options, bool* headless);
+void printHeadlessUsage(const char* name, bool interactive);
+//* Writes the options read by GranularMatter at init into the globals, the only place they are set from the command line
+void applyHeadlessOptions(const HeadlessOptions& options);
+
+//* Runs the simulation without window, surface or swapchain e.g. on render nodes or in CI
+class HeadlessApplication {
+public:
+    HeadlessApplication(HeadlessOptions options);
+
+    void run();
+private:
+    HeadlessOptions _options;
+    uint64_t substepCount = 0;
+
+    gpu::Core core;
+    vk::Device device;
+    gpu::ComputeContext computeContext;
+
+    GranularMatter simulation;
+
+    Mesh3D dumpTruck;
+    Mesh3D plane;
+    Mesh3D hourglas;
+
+    void initVulkan();
+    void mainLoop();
+    void stepFrame(size_t currentFrame);
+    void cleanup();
+};
@@ -156,6 +156,7 @@ void ImguiRenderPass::initFrameResources(){
 
 
 float drawAverageDensityError(void*, int i) { return simulationMetrics.averageDensityError.get(i) / settings.rho0; };
+float drawMaxDensityError(void*, int i) { return simulationMetrics.maxDensityError.get(i) / settings.rho0; };
 float drawIterationCount(void*, int i) { return simulationMetrics.iterationCount.get(i); };
 
 void ImguiRenderPass::update(int imageIndex, float dt){
@@ -245,6 +246,7 @@ void ImguiRenderPass::update(int imageIndex, float dt){
     ImGui::Begin("Metrics", &showGPUInfo); 
     {
         ImGui::PlotLines("Average density error", drawAverageDensityError, NULL, SimulationMetrics::MAX_VALUES_PER_METRIC, 0, NULL, 0.0f, settings.maxCompression, ImVec2(0, 80));
+        ImGui::PlotLines("Max density error", drawMaxDensityError, NULL, SimulationMetrics::MAX_VALUES_PER_METRIC, 0, NULL, 0.0f, settings.maxCompression, ImVec2(0, 80));
         ImGui::PlotLines("IISPH Iteration count", drawIterationCount, NULL, SimulationMetrics::MAX_VALUES_PER_METRIC, 0, NULL, 0, 20, ImVec2(0, 80));
         size_t currentFrame = _core->_swapchainContext._currentFrame;
         if (ImGui::BeginTable("Timings", 2))
@@ -265,6 +267,43 @@ void ImguiRenderPass::update(int imageIndex, float dt){
                 ImGui::TableSetColumnIndex(1);
                 ImGui::Text((std::to_string((timestamps[currentFrame][timestampLabels[currentFrame].size() - 1] - timestamps[currentFrame][0]) / (float)1000000) + " ms").c_str());
             }
+            const char* sortTimeLabels[] = { "Last bitonic sort", "Last radix sort", "Last counting sort" };
+            for (size_t backend = 0; backend < simulationMetrics.sortTime.size(); backend++)
+            {
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                ImGui::Text(sortTimeLabels[backend]);
+                ImGui::TableSetColumnIndex(1);
+                ImGui::Text((std::to_string(simulationMetrics.sortTime[backend]) + " ms").c_str());
+            }
+            if(fuseKernels)
+            {
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                ImGui::Text("Barriers saved by fusion");
+                ImGui::TableSetColumnIndex(1);
+                ImGui::Text(std::to_string(simulationMetrics.fusedBarriersSaved).c_str());
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                ImGui::Text("Traversals saved by fusion");
+                ImGui::TableSetColumnIndex(1);
+                ImGui::Text(std::to_string(simulationMetrics.fusedTraversalsSaved).c_str());
+            }
+            {
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                ImGui::Text("Stiffness tensors rebuilt");
+                ImGui::TableSetColumnIndex(1);
+                ImGui::Text(std::to_string(simulationMetrics.stiffnessRefreshCount).c_str());
+            }
+            if(sleepingParticles)
+            {
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                ImGui::Text("Awake particles");
+                ImGui::TableSetColumnIndex(1);
+                ImGui::Text((std::to_string(simulationMetrics.activeParticleCount) + " / " + std::to_string(settings.particleCount)).c_str());
+            }
             {
                 ImGui::TableNextRow();
                 ImGui::TableSetColumnIndex(0);
@@ -325,8 +364,21 @@ void ImguiRenderPass::update(int imageIndex, float dt){
                 ImGui::Text(std::to_string(subTimeStep).c_str());
         ImGui::EndTable();
 
-        ImGui::InputInt("Substeps", &substeps, 1 ,10);
+        ImGui::Checkbox("Adaptive timestep (CFL)", &adaptiveTimestep);
+        if(adaptiveTimestep){
+            ImGui::InputInt("Maximum substeps", &maxSubsteps, 1, 10);
+            ImGui::Text(("Substeps: " + std::to_string(substeps)).c_str());
+        }
+        else{
+            ImGui::InputInt("Substeps", &substeps, 1 ,10);
+        }
         ImGui::InputInt("Pause on frame", &pauseOnFrame, -1,10000);
+        const char* sortBackends[] = { "Bitonic sort", "Radix sort", "Counting sort" };
+        int currentSortBackend = static_cast<int>(sortBackend);
+        if(ImGui::Combo("Sort backend", &currentSortBackend, sortBackends, IM_ARRAYSIZE(sortBackends))){
+            sortBackend = static_cast<SortBackend>(currentSortBackend);
+        }
+        ImGui::InputInt("Reorder particles every n frames", &particleReorderInterval, 1, 10);
         ImGui::InputFloat("Maximum timestep", &settings.maxTimestep, 0.008f);
 
     
@@ -335,9 +387,17 @@ void ImguiRenderPass::update(int imageIndex, float dt){
         
         ImGui::SeparatorText("Material");
         ImGui::InputFloat("Maximum compression", &settings.maxCompression, 0.0001f, 0.001f);
+        const char* convergenceCriteria[] = { "Average density error", "Max density error" };
+        int currentCriterion = static_cast<int>(convergenceCriterion);
+        if(ImGui::Combo("Convergence criterion", &currentCriterion, convergenceCriteria, IM_ARRAYSIZE(convergenceCriteria))){
+            convergenceCriterion = static_cast<ConvergenceCriterion>(currentCriterion);
+        }
         ImGui::SliderFloat("Rest Density (kg/m^2)", &settings.rho0, 1.f, 3000.f );
         ImGui::SliderFloat("Mass (kg)", &settings.mass, 1.f, 100.f);
         ImGui::SliderAngle("Angle of repose",&settings.theta, 0.f, 90.f, "%.0f°");
+        if(sleepingParticles){
+            ImGui::InputFloat("Sleeping speed (m/s)", &settings.sleepingSpeed, 0.0001f, 0.001f, "%.4f");
+        }
         
         ImGui::SeparatorText("Air"); 
         ImGui::DragFloat3("Air velocity (m/s)", glm::value_ptr(settings.windDirection));
@@ -23,6 +23,7 @@
 #include "imgui_renderpass.h"
 #include "triangle_renderpass.h"
 #include "granular_matter.h"
+#include "headless_application.h"
 
 #include "global.h"
 #include "camera.h"
@@ -87,39 +88,18 @@ private:
         case 0: // Dump truck scene
             triangleRenderPass.models.push_back(dumpTruckModel);
             triangleRenderPass.models.push_back(planeModel);
-
-            core.updateBufferData(simulation.particlesBufferB, simulation.lrParticles2.data(), simulation.lrParticles2.size() * sizeof(LRParticle));
-            core.updateBufferData(simulation.particlesBufferHR, simulation.hrParticles2.data(), simulation.hrParticles2.size() * sizeof(HRParticle));
-
-            simulation.volumeMapTransforms[0].enable(); // enable dump_truck
-            simulation.volumeMapTransforms[1].enable(); // enable plane
-            simulation.volumeMapTransforms[2].disable(); // disable hourglas
             break;
         case 1: // Plane only
             triangleRenderPass.models.push_back(planeModel);
-
-            core.updateBufferData(simulation.particlesBufferB, simulation.lrParticles.data(), simulation.lrParticles.size() * sizeof(LRParticle));
-            core.updateBufferData(simulation.particlesBufferHR, simulation.hrParticles.data(), simulation.hrParticles.size() * sizeof(HRParticle));
-
-            simulation.volumeMapTransforms[0].disable(); // disable dump_truck
-            simulation.volumeMapTransforms[1].enable(); // enable plane
-            simulation.volumeMapTransforms[2].disable(); // disable hourglas
             break;
         case 2: // hourglas scene
             triangleRenderPass.models.push_back(hourglasModel);
-
-            core.updateBufferData(simulation.particlesBufferB, simulation.lrParticles2.data(), simulation.lrParticles2.size() * sizeof(LRParticle));
-            core.updateBufferData(simulation.particlesBufferHR, simulation.hrParticles2.data(), simulation.hrParticles2.size() * sizeof(HRParticle));
-
-            simulation.volumeMapTransforms[0].disable(); // disable dump_truck
-            simulation.volumeMapTransforms[1].disable(); // disable plane
-            simulation.volumeMapTransforms[2].enable(); // hourglas hourglas
             break;
         
         default:
             break;
         }
-        simulation.updateVolumeMapTransforms();
+        simulation.loadScene(scene);
     }
 
     void initVulkan(){
@@ -148,6 +128,9 @@ private:
         dumpTruck = Mesh3D(ASSETS_PATH"/models/dump_truck.glb");
         plane = Mesh3D(ASSETS_PATH"/models/plane.glb");
         hourglas = Mesh3D(ASSETS_PATH"/models/hourglas.glb");
+        dumpTruck.volumeMapFormat = volumeMapFormat;
+        plane.volumeMapFormat = volumeMapFormat;
+        hourglas.volumeMapFormat = volumeMapFormat;
 
         // create signed distance fields
         simulation.rigidBodies.push_back(&dumpTruck);
@@ -175,8 +158,20 @@ private:
             particleRenderPass.vertexBuffer[i] = simulation.particlesBufferHR;
         }
         particleRenderPass.vertexCount = (uint32_t)simulation.hrParticles.size();
-        particleRenderPass.attributeDescriptions = HRParticle::getAttributeDescriptions();
-        particleRenderPass.bindingDescription = HRParticle::getBindingDescription();
+        if(hrParticleFormat == HRParticleFormat::eCompact){
+            auto attributeDescriptions = CompactHRParticle::getAttributeDescriptions();
+            auto bindingDescription = CompactHRParticle::getBindingDescription();
+            particleRenderPass.attributeDescriptions.assign(attributeDescriptions.begin(), attributeDescriptions.end());
+            particleRenderPass.bindingDescription.assign(bindingDescription.begin(), bindingDescription.end());
+        }
+        else{
+            auto attributeDescriptions = HRParticle::getAttributeDescriptions();
+            auto bindingDescription = HRParticle::getBindingDescription();
+            particleRenderPass.attributeDescriptions.assign(attributeDescriptions.begin(), attributeDescriptions.end());
+            particleRenderPass.bindingDescription.assign(bindingDescription.begin(), bindingDescription.end());
+        }
+        particleRenderPass.colorPaletteBuffer = simulation.colorPaletteBuffer;
+        particleRenderPass.colorPaletteSize = sizeof(glm::vec4) * simulation.colorPalette.size();
 
         // for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++) {
         //     particleRenderPass.vertexBuffer[i] = simulation.particlesBufferB;
@@ -199,31 +194,8 @@ private:
 
         simulation.update((int)currentFrame, 0, dt);
         
-        std::array<vk::CommandBuffer, 1> submitComputeCommandBuffers = { 
-            simulation.getCommandBuffer((int)currentFrame)
-        }; 
-        
-        {
-            std::vector<vk::Semaphore> signalComputeSemaphores = {
-                computeContext._frames[currentFrame]._computeFinished
-            };
-
-            std::vector<vk::Semaphore> waitSemaphores = {
-                simulation.iisphSemaphores[currentFrame]
-            };
-            std::vector<vk::PipelineStageFlags> waitStages = {
-                vk::PipelineStageFlagBits::eComputeShader
-            };
-
-            vk::SubmitInfo computeSubmitInfo{
-                waitSemaphores,
-                waitStages,
-                submitComputeCommandBuffers,
-                signalComputeSemaphores
-            };
-
-            core.getComputeQueue().submit(computeSubmitInfo, computeContext._frames[currentFrame]._inFlight);
-        }
+        //* Queued behind the substep segments of the simulation on the timeline
+        uint64_t computeTimelineValue = core.submitTimeline(core.getComputeQueue(), simulation.getCommandBuffer((int)currentFrame), vk::PipelineStageFlagBits::eComputeShader, computeContext._frames[currentFrame]._inFlight);
 
         result = device.waitForFences(core.getCurrentFrame()._inFlight, VK_TRUE, UINT64_MAX);
         device.resetFences(core.getCurrentFrame()._inFlight);
@@ -244,11 +216,20 @@ private:
         triangleRenderPass.update(imageIndex, dt);
         imguiRenderPass.update(imageIndex, dt);
 
+        //* The render passes wait for the simulation on the same timeline and for the pipelined HR advection on the async one,
+        //* the value of a binary semaphore is ignored
         std::vector<vk::Semaphore> waitSemaphores = {
-            computeContext._frames[currentFrame]._computeFinished, 
+            core.getTimelineSemaphore(), 
+            core.getAsyncTimelineSemaphore(),
             core.getCurrentFrame()._imageAvailable
         };
+        std::vector<uint64_t> waitValues = {
+            computeTimelineValue,
+            core.getAsyncTimelineValue(),
+            0
+        };
         std::vector<vk::PipelineStageFlags> waitStages = {
+            vk::PipelineStageFlagBits::eVertexInput, 
             vk::PipelineStageFlagBits::eVertexInput, 
             vk::PipelineStageFlagBits::eColorAttachmentOutput
         };
@@ -260,7 +241,8 @@ private:
             triangleRenderPass.getCommandBuffer(), 
             imguiRenderPass.getCommandBuffer()
         };
-        vk::SubmitInfo submitInfo(waitSemaphores, waitStages, submitCommandBuffers, signalSemaphores);
+        vk::TimelineSemaphoreSubmitInfo timelineSubmitInfo(waitValues, {});
+        vk::SubmitInfo submitInfo(waitSemaphores, waitStages, submitCommandBuffers, signalSemaphores, &timelineSubmitInfo);
 
         core.getGraphicsQueue().submit(submitInfo, core.getCurrentFrame()._inFlight);
 
@@ -361,10 +343,24 @@ private:
     }
 };
 
-int main() {
-    Application app;
+int main(int argc, char* argv[]) {
+    bool headless = false;
+    HeadlessOptions options;
+    OptionsResult result = parseHeadlessOptions(argc, argv, options, &headless);
+    if(result != OptionsResult::eRun){
+        return result == OptionsResult::eHelp ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    applyHeadlessOptions(options);
+
     try {
-        app.run();
+        if(headless){
+            HeadlessApplication app(options);
+            app.run();
+        }
+        else{
+            Application app;
+            app.run();
+        }
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
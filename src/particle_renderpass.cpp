@@ -20,12 +20,17 @@ ParticleRenderPass::ParticleRenderPass(gpu::Core *core, gpu::Camera *camera)
 void ParticleRenderPass::init()
 {
 
-    vertShaderModule = _core->loadShaderModule(SHADER_PATH "/shader.vert");
+    std::vector<std::string> vertDefines;
+    if(hrParticleFormat == HRParticleFormat::eCompact){
+        vertDefines.push_back("COMPACT_HR_PARTICLES");
+    }
+    vertShaderModule = _core->loadShaderModule(SHADER_PATH "/shader.vert", vertDefines);
     fragShaderModule = _core->loadShaderModule(SHADER_PATH "/shader.frag");
     geomShaderModule = _core->loadShaderModule(SHADER_PATH"/shader.geom");
 
     descriptorSetLayout = _core->createDescriptorSetLayout({
-        {0, vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eGeometry}
+        {0, vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eGeometry},
+        {1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eVertex}
     });
     
     _renderContext = RenderContext(_core, vk::AttachmentLoadOp::eClear, vk::AttachmentStoreOp::eStore);
@@ -96,6 +101,7 @@ void ParticleRenderPass::createDescriptorSets()
     for (size_t i = 0; i < gpu::MAX_FRAMES_IN_FLIGHT; i++)
     {
         _core->addDescriptorWrite(descriptorSets[i], {0, vk::DescriptorType::eUniformBuffer, uniformBuffers[i], sizeof(UniformBufferObject)});
+        _core->addDescriptorWrite(descriptorSets[i], {1, vk::DescriptorType::eStorageBuffer, colorPaletteBuffer, colorPaletteSize});
         _core->updateDescriptorSet(descriptorSets[i]);
     }
 }
@@ -160,7 +166,7 @@ void ParticleRenderPass::createGraphicsPipeline()
 
 void ParticleRenderPass::createDescriptorPool()
 {
-    descriptorPool = _core->createDescriptorPool({{vk::DescriptorType::eUniformBuffer, 1 * gpu::MAX_FRAMES_IN_FLIGHT}}, 1 * gpu::MAX_FRAMES_IN_FLIGHT);
+    descriptorPool = _core->createDescriptorPool({{vk::DescriptorType::eUniformBuffer, 1 * gpu::MAX_FRAMES_IN_FLIGHT}, {vk::DescriptorType::eStorageBuffer, 1 * gpu::MAX_FRAMES_IN_FLIGHT}}, 1 * gpu::MAX_FRAMES_IN_FLIGHT);
 }
 
 void ParticleRenderPass::destroyFrameResources()
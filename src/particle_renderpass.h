@@ -27,8 +27,11 @@ namespace gpu{
             std::vector<vk::Buffer> vertexBuffer;
             uint32_t vertexCount;
 
-            std::array<vk::VertexInputBindingDescription, 1> bindingDescription;
-            std::array<vk::VertexInputAttributeDescription, 3> attributeDescriptions;
+            std::vector<vk::VertexInputBindingDescription> bindingDescription;
+            std::vector<vk::VertexInputAttributeDescription> attributeDescriptions;
+
+            vk::Buffer colorPaletteBuffer;                  //* palette of the compact HR particle format
+            size_t colorPaletteSize;
 
         private:
             gpu::Camera* m_camera;
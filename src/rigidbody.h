@@ -1,6 +1,8 @@
+#pragma once
 
 #include <glm/glm.hpp>
 #include "utils.h"
+#include "global.h"
 
 #include <tmd/TriangleMeshDistance.h>
 
@@ -16,14 +18,26 @@ struct AABB{
     };
 };
 
+//* Result of one combined signed distance query
+struct SignedDistanceSample{
+    float distance;
+    glm::vec3 gradient;                                 //* position - nearest surface point
+};
+
 struct RigidBody2D{
     bool active = false; // states if object is influenced by forces
     bool invert = false; // states uf the sdf should be inverted
     glm::vec3 position = glm::vec3(0.0);
     glm::vec3 scale = glm::vec3(1.0);
     AABB aabb;
+    VolumeMapFormat volumeMapFormat = VolumeMapFormat::eFloat32; // texel encoding of the baked volume map
     virtual glm::vec3 signedDistanceGradient(glm::vec3 position) = 0; // calculates the signed distance and direction 
     virtual float signedDistance(glm::vec3 position) = 0; // calculates the signed distance 
+    // calculates the signed distance and direction in one query, must be safe to call from several threads
+    virtual SignedDistanceSample signedDistanceSample(glm::vec3 position){
+        return { signedDistance(position), signedDistanceGradient(position) };
+    };
+    virtual uint64_t geometryHash() = 0; // identifies the shape of the signed distance field, keys the volume map cache
 };
 
 struct Box3D : public RigidBody2D{
@@ -42,6 +56,9 @@ struct Box3D : public RigidBody2D{
         glm::vec3 q = glm::abs(p) - halfSize;
         return glm::length(glm::max(q,glm::vec3(0.0))) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.f);
     };
+    uint64_t geometryHash() override {
+        return hashBytes(&halfSize, sizeof(halfSize), hashBytes("Box3D", 5));
+    };
 };
 
 struct Plane3D : public RigidBody2D{
@@ -59,6 +76,9 @@ struct Plane3D : public RigidBody2D{
     float signedDistance(glm::vec3 p) override {
         return (glm::dot(p, normal) + h);
     };
+    uint64_t geometryHash() override {
+        return hashBytes(&h, sizeof(h), hashBytes(&normal, sizeof(normal), hashBytes("Plane3D", 7)));
+    };
 };
 
 
@@ -77,4 +97,12 @@ struct Mesh3D : public RigidBody2D{
         tmd::Result result = mesh_distance.signed_distance({ p.x, p.y, p.z });
         return result.distance;
     };
+    SignedDistanceSample signedDistanceSample(glm::vec3 p) override {
+        tmd::Result result = mesh_distance.signed_distance({ p.x, p.y, p.z });
+        return { (float)result.distance, p - glm::vec3(result.nearest_point[0], result.nearest_point[1], result.nearest_point[2]) };
+    };
+    uint64_t geometryHash() override {
+        uint64_t hash = hashBytes(vertices.data(), vertices.size() * sizeof(vertices[0]), hashBytes("Mesh3D", 6));
+        return hashBytes(triangles.data(), triangles.size() * sizeof(triangles[0]), hash);
+    };
 };
@@ -26,13 +26,17 @@ std::string preprocess_shader(const std::string& source_name,
 
 // Compiles a shader to a SPIR-V binary. Returns the binary as
 // a vector of 32-bit words.
-std::vector<uint32_t> compile_file(const std::string& source_name, shaderc_shader_kind kind, const std::string& source, shaderc_optimization_level optimization) {
+std::vector<uint32_t> compile_file(const std::string& source_name, shaderc_shader_kind kind, const std::string& source, const std::vector<std::string>& defines, shaderc_optimization_level optimization) {
 
   shaderc::Compiler compiler;
   shaderc::CompileOptions options;
 
   options.SetOptimizationLevel(optimization);
+  options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_1); // subgroup operations
   options.SetGenerateDebugInfo();
+  for (const std::string& define : defines) {
+    options.AddMacroDefinition(define);
+  }
 
   shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(source, kind, source_name.c_str(), options);
 
@@ -9,4 +9,5 @@ std::string preprocess_shader(const std::string& source_name, shaderc_shader_kin
 
 // std::string compile_file_to_assembly(const std::string& source_name, shaderc_shader_kind kind, const std::string& source, bool optimize = false);
 
-std::vector<uint32_t> compile_file(const std::string& source_name, shaderc_shader_kind kind,  const std::string& source, shaderc_optimization_level optimization = shaderc_optimization_level_zero);
\ No newline at end of file
+// Defines are set like -DNAME
+std::vector<uint32_t> compile_file(const std::string& source_name, shaderc_shader_kind kind,  const std::string& source, const std::vector<std::string>& defines = {}, shaderc_optimization_level optimization = shaderc_optimization_level_zero);
\ No newline at end of file
@@ -1,7 +1,20 @@
 #pragma once
+#include <cstdint>
+#include <cstddef>
 
 namespace std{
     template <typename T> int sign(T val) {
         return (T(0) < val) - (val < T(0));
     }
-}
\ No newline at end of file
+}
+
+//* 64 bit FNV-1a, chain calls by passing the previous hash as seed
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325ull){
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+    for(size_t i = 0; i < size; i++){
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
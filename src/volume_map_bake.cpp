@@ -0,0 +1,250 @@
+#include "volume_map_bake.h"
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <map>
+#include <numeric>
+
+//* Spreads the lower 10 bits of v to every third bit
+static uint32_t expandBits(uint32_t v){
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+static uint32_t mortonCode(glm::vec3 p){
+    glm::uvec3 q = glm::uvec3(glm::clamp(p * 1024.f, glm::vec3(0.f), glm::vec3(1023.f)));
+    return (expandBits(q.x) << 2) | (expandBits(q.y) << 1) | expandBits(q.z);
+}
+
+static VolumeMapBakeBounds emptyBounds(){
+    return { glm::vec4(FLT_MAX), glm::vec4(-FLT_MAX) };
+}
+
+static void extendBounds(VolumeMapBakeBounds& bounds, const VolumeMapBakeBounds& other){
+    bounds.min = glm::min(bounds.min, other.min);
+    bounds.max = glm::max(bounds.max, other.max);
+}
+
+VolumeMapBakeGeometry buildVolumeMapBakeGeometry(const Mesh3D& mesh){
+    size_t triangleCount = mesh.triangles.size();
+    std::vector<glm::dvec3> vertices(mesh.vertices.size());
+    for(size_t i = 0; i < vertices.size(); i++){
+        vertices[i] = glm::dvec3(mesh.vertices[i][0], mesh.vertices[i][1], mesh.vertices[i][2]);
+    }
+
+    //* Pseudo normals as in TriangleMeshDistance, so both bakes agree on the sign
+    std::vector<glm::dvec3> faceNormals(triangleCount);
+    std::vector<glm::dvec3> vertexNormals(vertices.size(), glm::dvec3(0.0));
+    std::map<std::pair<int, int>, glm::dvec3> edgeNormals;
+    for(size_t t = 0; t < triangleCount; t++){
+        const std::array<int, 3>& triangle = mesh.triangles[t];
+        glm::dvec3 a = vertices[triangle[0]];
+        glm::dvec3 b = vertices[triangle[1]];
+        glm::dvec3 c = vertices[triangle[2]];
+        glm::dvec3 normal = glm::cross(b - a, c - a);
+        double length = glm::length(normal);
+        faceNormals[t] = length > 0.0 ? normal / length : glm::dvec3(0.0);
+
+        for(int i = 0; i < 3; i++){
+            glm::dvec3 e0 = vertices[triangle[(i + 1) % 3]] - vertices[triangle[i]];
+            glm::dvec3 e1 = vertices[triangle[(i + 2) % 3]] - vertices[triangle[i]];
+            if(glm::length(e0) > 0.0 && glm::length(e1) > 0.0){
+                double angle = std::acos(glm::clamp(glm::dot(glm::normalize(e0), glm::normalize(e1)), -1.0, 1.0));
+                vertexNormals[triangle[i]] += angle * faceNormals[t];
+            }
+
+            int v0 = triangle[i];
+            int v1 = triangle[(i + 1) % 3];
+            edgeNormals.try_emplace(std::make_pair(std::min(v0, v1), std::max(v0, v1)), glm::dvec3(0.0)).first->second += faceNormals[t];
+        }
+    }
+
+    auto safeNormalize = [](glm::dvec3 n){
+        double length = glm::length(n);
+        return length > 0.0 ? glm::vec4(glm::vec3(n / length), 0.f) : glm::vec4(0.f);
+    };
+
+    glm::vec3 meshMin = mesh.aabb.min;
+    glm::vec3 meshExtent = glm::max(mesh.aabb.max - mesh.aabb.min, glm::vec3(FLT_MIN));
+    std::vector<uint32_t> codes(triangleCount);
+    for(size_t t = 0; t < triangleCount; t++){
+        const std::array<int, 3>& triangle = mesh.triangles[t];
+        glm::vec3 centroid = glm::vec3((vertices[triangle[0]] + vertices[triangle[1]] + vertices[triangle[2]]) / 3.0);
+        codes[t] = mortonCode((centroid - meshMin) / meshExtent);
+    }
+    std::vector<uint32_t> order(triangleCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t l, uint32_t r){ return codes[l] < codes[r]; });
+
+    VolumeMapBakeGeometry geometry;
+    geometry.triangles.resize(triangleCount);
+    geometry.clusters.assign((triangleCount + VOLUME_MAP_BAKE_CLUSTER_SIZE - 1) / VOLUME_MAP_BAKE_CLUSTER_SIZE, emptyBounds());
+    geometry.groups.assign((geometry.clusters.size() + VOLUME_MAP_BAKE_GROUP_SIZE - 1) / VOLUME_MAP_BAKE_GROUP_SIZE, emptyBounds());
+    for(size_t i = 0; i < triangleCount; i++){
+        uint32_t t = order[i];
+        const std::array<int, 3>& triangle = mesh.triangles[t];
+        int ia = triangle[0];
+        int ib = triangle[1];
+        int ic = triangle[2];
+
+        VolumeMapBakeTriangle& bakeTriangle = geometry.triangles[i];
+        bakeTriangle.a = glm::vec4(glm::vec3(vertices[ia]), 1.f);
+        bakeTriangle.b = glm::vec4(glm::vec3(vertices[ib]), 1.f);
+        bakeTriangle.c = glm::vec4(glm::vec3(vertices[ic]), 1.f);
+        bakeTriangle.normals[0] = safeNormalize(faceNormals[t]);
+        bakeTriangle.normals[1] = safeNormalize(vertexNormals[ia]);
+        bakeTriangle.normals[2] = safeNormalize(vertexNormals[ib]);
+        bakeTriangle.normals[3] = safeNormalize(vertexNormals[ic]);
+        bakeTriangle.normals[4] = safeNormalize(edgeNormals.at(std::make_pair(std::min(ia, ib), std::max(ia, ib))));
+        bakeTriangle.normals[5] = safeNormalize(edgeNormals.at(std::make_pair(std::min(ib, ic), std::max(ib, ic))));
+        bakeTriangle.normals[6] = safeNormalize(edgeNormals.at(std::make_pair(std::min(ic, ia), std::max(ic, ia))));
+
+        VolumeMapBakeBounds bounds = {
+            glm::min(bakeTriangle.a, glm::min(bakeTriangle.b, bakeTriangle.c)),
+            glm::max(bakeTriangle.a, glm::max(bakeTriangle.b, bakeTriangle.c))
+        };
+        extendBounds(geometry.clusters[i / VOLUME_MAP_BAKE_CLUSTER_SIZE], bounds);
+    }
+    for(size_t i = 0; i < geometry.clusters.size(); i++){
+        extendBounds(geometry.groups[i / VOLUME_MAP_BAKE_GROUP_SIZE], geometry.clusters[i]);
+    }
+    return geometry;
+}
+
+VolumeMapBricks buildVolumeMapBricks(const glm::vec4* samples, glm::uvec3 size, float h, uint32_t maxImageDimension){
+    VolumeMapBricks bricks;
+    bricks.brickCount = (size - 1u) / VOLUME_MAP_BRICK_SIZE + 1u;
+    std::vector<uint32_t> table(bricks.brickCount.x * bricks.brickCount.y * bricks.brickCount.z, VOLUME_MAP_EMPTY_BRICK);
+
+    auto sample = [&](glm::uvec3 voxel){
+        voxel = glm::min(voxel, size - 1u);
+        return samples[(voxel.z * size.y + voxel.y) * size.x + voxel.x];
+    };
+
+    //* A trilinear sample is a convex combination of its cell corners, it is at least as long as the distance
+    //* of their bounding box to the origin. Bricks where no cell box reaches within h are never used by the shaders
+    std::vector<glm::uvec3> allocated;
+    for(uint32_t bz = 0; bz < bricks.brickCount.z; bz++){
+        for(uint32_t by = 0; by < bricks.brickCount.y; by++){
+            for(uint32_t bx = 0; bx < bricks.brickCount.x; bx++){
+                glm::uvec3 brick = glm::uvec3(bx, by, bz);
+                bool inNarrowBand = false;
+                for(uint32_t cz = 0; cz < VOLUME_MAP_BRICK_SIZE && !inNarrowBand; cz++){
+                    for(uint32_t cy = 0; cy < VOLUME_MAP_BRICK_SIZE && !inNarrowBand; cy++){
+                        for(uint32_t cx = 0; cx < VOLUME_MAP_BRICK_SIZE && !inNarrowBand; cx++){
+                            glm::uvec3 cell = brick * VOLUME_MAP_BRICK_SIZE + glm::uvec3(cx, cy, cz);
+                            glm::vec3 cornerMin = glm::vec3(FLT_MAX);
+                            glm::vec3 cornerMax = glm::vec3(-FLT_MAX);
+                            for(uint32_t corner = 0; corner < 8; corner++){
+                                glm::vec3 offset = glm::vec3(sample(cell + glm::uvec3(corner & 1, (corner >> 1) & 1, corner >> 2)));
+                                cornerMin = glm::min(cornerMin, offset);
+                                cornerMax = glm::max(cornerMax, offset);
+                            }
+                            glm::vec3 closest = glm::clamp(glm::vec3(0.f), cornerMin, cornerMax);
+                            //* NaN offsets (samples exactly on the surface) always keep the brick
+                            inNarrowBand = !(glm::length(closest) >= h);
+                        }
+                    }
+                }
+                if(inNarrowBand){
+                    table[(bz * bricks.brickCount.y + by) * bricks.brickCount.x + bx] = (uint32_t)allocated.size();
+                    allocated.push_back(brick);
+                }
+            }
+        }
+    }
+
+    //* Pack the bricks into the flattest atlas that stays within the image limits
+    uint32_t maxBricks = maxImageDimension / VOLUME_MAP_BRICK_SAMPLES;
+    uint32_t slotCount = std::max((uint32_t)allocated.size(), 1u);
+    bricks.atlasSize.x = std::min(slotCount, maxBricks);
+    bricks.atlasSize.y = std::min((slotCount + bricks.atlasSize.x - 1) / bricks.atlasSize.x, maxBricks);
+    bricks.atlasSize.z = (slotCount + bricks.atlasSize.x * bricks.atlasSize.y - 1) / (bricks.atlasSize.x * bricks.atlasSize.y);
+    if(bricks.atlasSize.z > maxBricks){
+        return bricks;
+    }
+
+    glm::uvec3 atlasSamples = bricks.atlasSize * VOLUME_MAP_BRICK_SAMPLES;
+    bricks.atlas.assign((size_t)atlasSamples.x * atlasSamples.y * atlasSamples.z, glm::vec4(0.f));
+    for(uint32_t slot = 0; slot < allocated.size(); slot++){
+        glm::uvec3 atlasBrick = glm::uvec3(slot % bricks.atlasSize.x, (slot / bricks.atlasSize.x) % bricks.atlasSize.y, slot / (bricks.atlasSize.x * bricks.atlasSize.y));
+        for(uint32_t z = 0; z < VOLUME_MAP_BRICK_SAMPLES; z++){
+            for(uint32_t y = 0; y < VOLUME_MAP_BRICK_SAMPLES; y++){
+                for(uint32_t x = 0; x < VOLUME_MAP_BRICK_SAMPLES; x++){
+                    glm::uvec3 local = glm::uvec3(x, y, z);
+                    glm::uvec3 texel = atlasBrick * VOLUME_MAP_BRICK_SAMPLES + local;
+                    bricks.atlas[((size_t)texel.z * atlasSamples.y + texel.y) * atlasSamples.x + texel.x] = sample(allocated[slot] * VOLUME_MAP_BRICK_SIZE + local);
+                }
+            }
+        }
+    }
+    bricks.allocatedCount = (uint32_t)allocated.size();
+    bricks.table = std::move(table);
+    return bricks;
+}
+
+static glm::vec2 octahedralEncode(glm::vec3 n){
+    n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    glm::vec2 e = glm::vec2(n.x, n.y);
+    if(n.z < 0.f){
+        e = (1.f - glm::abs(glm::vec2(e.y, e.x))) * glm::vec2(e.x >= 0.f ? 1.f : -1.f, e.y >= 0.f ? 1.f : -1.f);
+    }
+    return e;
+}
+
+static glm::vec3 octahedralDecode(glm::vec2 e){
+    glm::vec3 n = glm::vec3(e.x, e.y, 1.f - std::abs(e.x) - std::abs(e.y));
+    float t = std::max(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -t : t;
+    n.y += n.y >= 0.f ? -t : t;
+    return glm::normalize(n);
+}
+
+float volumeMapLengthScale(const glm::vec4* texels, size_t count){
+    float lengthScale = 0.f;
+    for(size_t i = 0; i < count; i++){
+        float length = glm::length(glm::vec3(texels[i]));
+        if(std::isfinite(length)){
+            lengthScale = std::max(lengthScale, length);
+        }
+    }
+    return std::max(lengthScale, FLT_MIN);
+}
+
+std::vector<uint16_t> encodeVolumeMap(const glm::vec4* texels, size_t count, VolumeMapFormat format, float lengthScale){
+    std::vector<uint16_t> encoded(4 * count);
+    for(size_t i = 0; i < count; i++){
+        glm::vec4 texel = texels[i];
+        uint16_t* out = &encoded[4 * i];
+        if(format == VolumeMapFormat::eFloat16){
+            for(int c = 0; c < 4; c++){
+                out[c] = glm::packHalf1x16(texel[c]);
+            }
+        }
+        else{
+            //* Samples exactly on the surface have no direction, they are stored as a zero offset
+            glm::vec3 offset = glm::vec3(texel);
+            float length = glm::length(offset);
+            glm::vec2 direction = length > 0.f && std::isfinite(length) ? octahedralEncode(offset / length) : glm::vec2(0.f);
+            length = std::isfinite(length) ? length : 0.f;
+            out[0] = glm::packSnorm1x16(direction.x);
+            out[1] = glm::packSnorm1x16(direction.y);
+            out[2] = glm::packSnorm1x16(length / lengthScale);
+            out[3] = glm::packSnorm1x16(texel.w);
+        }
+    }
+    return encoded;
+}
+
+glm::vec4 decodeVolumeMapTexel(const uint16_t* texel, VolumeMapFormat format, float lengthScale){
+    if(format == VolumeMapFormat::eFloat16){
+        return glm::vec4(glm::unpackHalf1x16(texel[0]), glm::unpackHalf1x16(texel[1]), glm::unpackHalf1x16(texel[2]), glm::unpackHalf1x16(texel[3]));
+    }
+    glm::vec2 direction = glm::vec2(glm::unpackSnorm1x16(texel[0]), glm::unpackSnorm1x16(texel[1]));
+    float length = glm::unpackSnorm1x16(texel[2]) * lengthScale;
+    return glm::vec4(octahedralDecode(direction) * length, glm::unpackSnorm1x16(texel[3]));
+}
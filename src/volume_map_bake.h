@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "rigidbody.h"
+
+//* Triangles per cluster and clusters per group of the bake acceleration structure, see bake_volume_map.comp
+const uint32_t VOLUME_MAP_BAKE_CLUSTER_SIZE = 32;
+const uint32_t VOLUME_MAP_BAKE_GROUP_SIZE = 32;
+//* z-slabs per bake submission, keeps single dispatches short on slow or software devices
+const uint32_t VOLUME_MAP_BAKE_SLABS_PER_SUBMIT = 16;
+
+//* Triangle with the angle weighted pseudo normals that sign the distance to each of its features
+struct VolumeMapBakeTriangle{
+    glm::vec4 a;
+    glm::vec4 b;
+    glm::vec4 c;
+    glm::vec4 normals[7];                               //* 0: face, 1-3: vertices a, b, c, 4-6: edges ab, bc, ca
+};
+
+struct VolumeMapBakeBounds{
+    glm::vec4 min;
+    glm::vec4 max;
+};
+
+//* Push constants of bake_volume_map.comp
+struct VolumeMapBakeParameters{
+    glm::vec4 aabbMin;
+    glm::vec4 stepSize;
+    glm::uvec4 size;                                    //* w: first z-slab of the submission
+    uint32_t triangleCount;
+    uint32_t clusterCount;
+    uint32_t groupCount;
+    float r_LR;
+    float h_LR;
+    float pad0;
+    float pad1;
+    float pad2;
+};
+
+//* Triangles sorted along a Morton curve of their centroids, consecutive runs form the clusters and groups
+struct VolumeMapBakeGeometry{
+    std::vector<VolumeMapBakeTriangle> triangles;
+    std::vector<VolumeMapBakeBounds> clusters;
+    std::vector<VolumeMapBakeBounds> groups;
+};
+
+VolumeMapBakeGeometry buildVolumeMapBakeGeometry(const Mesh3D& mesh);
+
+//* Sparse volume maps, see sampleVolumeMap in the shaders
+const uint32_t VOLUME_MAP_BRICK_SIZE = 8;                                   //* voxels per brick edge
+const uint32_t VOLUME_MAP_BRICK_SAMPLES = VOLUME_MAP_BRICK_SIZE + 1;        //* plus the first voxel of the next brick for trilinear filtering
+const uint32_t VOLUME_MAP_EMPTY_BRICK = 0xffffffff;
+
+struct VolumeMapBricks{
+    glm::uvec3 brickCount = glm::uvec3(0);              //* bricks per axis over the dense map
+    glm::uvec3 atlasSize = glm::uvec3(0);               //* bricks per axis of the atlas
+    uint32_t allocatedCount = 0;
+    std::vector<uint32_t> table;                        //* atlas slot per brick, VOLUME_MAP_EMPTY_BRICK outside the narrow band
+    std::vector<glm::vec4> atlas;
+};
+
+//* Keeps the bricks in which any trilinear sample can come closer than h to the surface, the table is empty if the
+//* atlas does not fit into maxImageDimension texels per axis
+VolumeMapBricks buildVolumeMapBricks(const glm::vec4* samples, glm::uvec3 size, float h, uint32_t maxImageDimension);
+
+//* Compact volume map texels, four 16 bit values each. Offsets are stored relative to lengthScale in the octahedral format
+float volumeMapLengthScale(const glm::vec4* texels, size_t count);
+std::vector<uint16_t> encodeVolumeMap(const glm::vec4* texels, size_t count, VolumeMapFormat format, float lengthScale);
+//* Same decoding as decodeVolumeMapTexel in the shaders
+glm::vec4 decodeVolumeMapTexel(const uint16_t* texel, VolumeMapFormat format, float lengthScale);
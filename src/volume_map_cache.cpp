@@ -0,0 +1,146 @@
+#include "volume_map_cache.h"
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedVolumeMap::~MappedVolumeMap(){
+    close();
+}
+
+bool MappedVolumeMap::open(const std::string& path, uint64_t key, glm::uvec3 size){
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE){
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0){
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(mappingHandle == nullptr){
+        CloseHandle(file);
+        return false;
+    }
+    _mapping = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    _fileHandle = file;
+    _mappingHandle = mappingHandle;
+    _mappingSize = (size_t)fileSize.QuadPart;
+#else
+    int file = ::open(path.c_str(), O_RDONLY);
+    if(file < 0){
+        return false;
+    }
+    struct stat fileStat;
+    if(fstat(file, &fileStat) != 0 || fileStat.st_size == 0){
+        ::close(file);
+        return false;
+    }
+    void* mapping = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    //* The mapping stays valid after the descriptor is closed
+    ::close(file);
+    _mapping = mapping == MAP_FAILED ? nullptr : mapping;
+    _mappingSize = (size_t)fileStat.st_size;
+#endif
+    if(_mapping == nullptr){
+        close();
+        return false;
+    }
+
+    size_t sampleCount = (size_t)size.x * size.y * size.z;
+    if(_mappingSize != sizeof(VolumeMapFileHeader) + sampleCount * sizeof(glm::vec4)){
+        close();
+        return false;
+    }
+
+    VolumeMapFileHeader expected;
+    VolumeMapFileHeader header;
+    std::memcpy(&header, _mapping, sizeof(header));
+    if(std::memcmp(header.magic, expected.magic, sizeof(expected.magic)) != 0 || header.version != expected.version || header.key != key
+        || header.width != size.x || header.height != size.y || header.depth != size.z){
+        close();
+        return false;
+    }
+
+    _samples = reinterpret_cast<const glm::vec4*>(static_cast<const char*>(_mapping) + sizeof(VolumeMapFileHeader));
+    return true;
+}
+
+void MappedVolumeMap::close(){
+#ifdef _WIN32
+    if(_mapping != nullptr){
+        UnmapViewOfFile(_mapping);
+    }
+    if(_mappingHandle != nullptr){
+        CloseHandle(_mappingHandle);
+    }
+    if(_fileHandle != nullptr){
+        CloseHandle(_fileHandle);
+    }
+    _fileHandle = nullptr;
+    _mappingHandle = nullptr;
+#else
+    if(_mapping != nullptr){
+        munmap(_mapping, _mappingSize);
+    }
+#endif
+    _mapping = nullptr;
+    _mappingSize = 0;
+    _samples = nullptr;
+}
+
+std::string volumeMapCachePath(const std::string& directory, uint64_t key){
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.vmap", (unsigned long long)key);
+    return (std::filesystem::path(directory) / name).string();
+}
+
+bool writeVolumeMapCache(const std::string& path, uint64_t key, glm::uvec3 size, const std::vector<glm::vec4>& samples){
+    std::error_code error;
+    std::filesystem::path target(path);
+    std::filesystem::create_directories(target.parent_path(), error);
+    if(error){
+        return false;
+    }
+
+    VolumeMapFileHeader header;
+    header.key = key;
+    header.width = size.x;
+    header.height = size.y;
+    header.depth = size.z;
+
+    std::filesystem::path temporary = target;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(glm::vec4));
+        if(!file){
+            file.close();
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(temporary, target, error);
+    if(error){
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+//* Bumped whenever the baked values change for the same inputs, invalidates all cached volume maps
+const uint32_t VOLUME_MAP_CACHE_VERSION = 1;
+
+//* Precedes the vec4 samples of a cached volume map, the samples start 16 byte aligned
+struct VolumeMapFileHeader{
+    char magic[4] = { 'G', 'M', 'V', 'M' };
+    uint32_t version = VOLUME_MAP_CACHE_VERSION;
+    uint64_t key = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t depth = 0;
+    uint32_t pad0 = 0;
+};
+
+//* Read only memory mapping of a cached volume map, unmapped on destruction
+class MappedVolumeMap{
+public:
+    MappedVolumeMap() = default;
+    MappedVolumeMap(const MappedVolumeMap&) = delete;
+    MappedVolumeMap& operator=(const MappedVolumeMap&) = delete;
+    ~MappedVolumeMap();
+
+    //* Fails if the file is missing, truncated or was baked for another key, version or size
+    bool open(const std::string& path, uint64_t key, glm::uvec3 size);
+    void close();
+    inline const glm::vec4* data() const { return _samples; };
+private:
+    void* _mapping = nullptr;
+    size_t _mappingSize = 0;
+    const glm::vec4* _samples = nullptr;
+#ifdef _WIN32
+    void* _fileHandle = nullptr;
+    void* _mappingHandle = nullptr;
+#endif
+};
+
+//* <directory>/<key in hex>.vmap
+std::string volumeMapCachePath(const std::string& directory, uint64_t key);
+
+//* Written to a temporary file first and renamed, concurrent launches never map a partial file
+bool writeVolumeMapCache(const std::string& path, uint64_t key, glm::uvec3 size, const std::vector<glm::vec4>& samples);